@@ -0,0 +1,230 @@
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "c_compiler.h"
+
+/**
+ * Count the nodes of a tree.
+ *
+ * @param node Tree
+ *
+ * @return Number of nodes
+ */
+static uint64_t count_nodes(Node *node) {
+  if (!node->lhs) return 1;
+  return 1 + count_nodes(node->lhs) + count_nodes(node->rhs);
+}
+
+/**
+ * Write the nodes of a tree in post-order.
+ *
+ * @param out Output stream
+ * @param node Tree
+ * @param next Index of the next node written, updated
+ *
+ * @return Index of the node
+ */
+static uint32_t write_nodes(FILE *out, Node *node, uint32_t *next) {
+  AstNode an = {.kind = node->kind};
+  if (node->lhs) {
+    an.lhs = write_nodes(out, node->lhs, next);
+    an.rhs = write_nodes(out, node->rhs, next);
+  } else {
+    an.val = node->kind == NODE_NUM ? node->val : node->col;
+  }
+  fwrite(&an, sizeof(an), 1, out);
+  return (*next)++;
+}
+
+/**
+ * Write a tree and the input columns in the binary AST format.
+ *
+ * @param out Output stream
+ * @param node Tree
+ */
+void write_ast(FILE *out, Node *node) {
+  AstHeader header = {
+      .magic   = AST_MAGIC,
+      .version = AST_VERSION,
+      .nodes   = count_nodes(node),
+  };
+  if (header.nodes > UINT32_MAX) error("too many nodes for a binary AST");
+
+  for (Column *col = columns; col; col = col->next) {
+    header.columns++;
+    header.names += col->len;
+  }
+  fwrite(&header, sizeof(header), 1, out);
+
+  uint32_t next = 0;
+  write_nodes(out, node, &next);
+
+  // Columns by index, then their names
+  uint64_t offset = 0;
+  for (uint64_t i = 0; i < header.columns; i++) {
+    Column *col = columns;
+    while (col->index != i) col = col->next;
+    AstColumn ac = {.name = offset, .len = col->len};
+    fwrite(&ac, sizeof(ac), 1, out);
+    offset += col->len;
+  }
+  for (uint64_t i = 0; i < header.columns; i++) {
+    Column *col = columns;
+    while (col->index != i) col = col->next;
+    fwrite(col->name, 1, col->len, out);
+  }
+}
+
+/**
+ * Check that the nodes of a binary AST are a tree in post-order, rooted at the
+ * last one, by running them on a stack of node indices: a leaf pushes itself,
+ * and a binary pops its right- and left-hand sides.
+ *
+ * @param ast Binary AST
+ *
+ * @return Is it
+ */
+static bool check_nodes(Ast *ast) {
+  uint32_t *stack = malloc(ast->header->nodes * sizeof(uint32_t));
+  if (!stack) error("out of memory");
+
+  size_t depth = 0;
+  bool ok      = true;
+  for (uint32_t i = 0; ok && i < ast->header->nodes; i++) {
+    AstNode *an = &ast->nodes[i];
+    if (an->kind == NODE_NUM) {
+      stack[depth++] = i;
+    } else if (an->kind == NODE_COL) {
+      ok             = an->val >= 0 && an->val < ast->header->columns;
+      stack[depth++] = i;
+    } else {
+      ok = an->kind < NODE_NUM && depth >= 2 && stack[depth - 1] == an->rhs &&
+           stack[depth - 2] == an->lhs;
+      if (ok) stack[--depth - 1] = i;
+    }
+  }
+
+  free(stack);
+  return ok && depth == 1;
+}
+
+/**
+ * Map a binary AST file into memory and check it.
+ *
+ * @param path File path
+ *
+ * @return Binary AST
+ */
+Ast *map_ast(char *path) {
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0)
+    error("cannot open %s: %s", path, strerror(errno));
+
+  Ast *ast  = mem_alloc(MEM_INPUT, sizeof(Ast));
+  ast->size = st.st_size;
+  if (ast->size < sizeof(AstHeader)) error("%s: not a binary AST", path);
+
+  void *p = mmap(NULL, ast->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) error("cannot map %s: %s", path, strerror(errno));
+
+  AstHeader *header = p;
+  if (memcmp(header->magic, AST_MAGIC, sizeof(header->magic)))
+    error("%s: not a binary AST", path);
+  if (header->version != AST_VERSION)
+    error("%s: binary AST version %u, expected %u", path, header->version,
+          AST_VERSION);
+
+  size_t max = ast->size - sizeof(AstHeader);
+  if (header->nodes == 0 || header->nodes > UINT32_MAX ||
+      header->columns > max / sizeof(AstColumn) ||
+      header->nodes > (max - header->columns * sizeof(AstColumn)) /
+                          sizeof(AstNode) ||
+      header->names != max - header->nodes * sizeof(AstNode) -
+                           header->columns * sizeof(AstColumn))
+    error("%s: truncated binary AST", path);
+
+  ast->header = header;
+  ast->nodes  = (AstNode *)(header + 1);
+  ast->cols   = (AstColumn *)(ast->nodes + header->nodes);
+  ast->names  = (char *)(ast->cols + header->columns);
+
+  if (!check_nodes(ast)) error("%s: malformed binary AST", path);
+
+  // The columns become those of the program, with names in the mapping, last
+  // first as the parser adds them
+  for (uint64_t i = 0; i < header->columns; i++) {
+    AstColumn *ac = &ast->cols[i];
+    if (ac->name > header->names || ac->len > header->names - ac->name)
+      error("%s: malformed binary AST", path);
+
+    Column *col = mem_alloc(MEM_COLUMN, sizeof(Column));
+    col->next   = columns;
+    col->name   = ast->names + ac->name;
+    col->len    = ac->len;
+    col->index  = i;
+    columns     = col;
+  }
+  return ast;
+}
+
+/**
+ * Build the tree of a binary AST, for the passes that need one. The nodes are
+ * allocated from node_arena.
+ *
+ * @param ast Binary AST
+ *
+ * @return Tree
+ */
+Node *ast_tree(Ast *ast) {
+  static Arena arena = {.cat = MEM_NODE};
+  node_arena         = &arena;
+
+  uint64_t n  = ast->header->nodes;
+  Node **tree = malloc(n * sizeof(Node *));
+  if (!tree) error("out of memory");
+
+  for (uint64_t i = 0; i < n; i++) {
+    AstNode *an = &ast->nodes[i];
+    if (an->kind == NODE_NUM) {
+      tree[i] = new_num(an->val);
+    } else if (an->kind == NODE_COL) {
+      tree[i]      = new_node(NODE_COL);
+      tree[i]->col = an->val;
+    } else {
+      tree[i] = new_binary(an->kind, tree[an->lhs], tree[an->rhs]);
+    }
+  }
+
+  Node *root = tree[n - 1];
+  free(tree);
+  return root;
+}
+
+/**
+ * Generate code for a binary AST like gen() does, but by walking the mapped
+ * nodes instead of a tree: in post-order, they are the stack machine program.
+ *
+ * @param ast Binary AST
+ */
+void gen_ast(Ast *ast) {
+  for (uint64_t i = 0; i < ast->header->nodes; i++) {
+    AstNode *an = &ast->nodes[i];
+    if (an->kind == NODE_NUM) {
+      emit("  push %d\n", an->val);
+      continue;
+    }
+    pop("rdi");
+    pop("rax");
+    gen_binary(an->kind);
+    push();
+  }
+}
@@ -0,0 +1,74 @@
+#!/bin/bash -u
+
+# Compare loading a binary AST (--from-ast) with tokenizing and parsing the
+# source again, on a long sum, a random balanced expression and a list of
+# statements. Prints the size of the source and of the AST, the time taken to
+# tokenize and parse, to map and check the AST, and to build a tree from it
+# for the passes that need one, and the best wall time of compiling each at
+# -O0, where the code is generated from the mapped AST without a tree.
+
+cd "$(dirname "$0")/.."
+
+runs=3
+dir=tmp-ast
+rm -rf $dir
+mkdir -p $dir
+
+# Deep expressions recurse deeply in the parser and code generator
+ulimit -s unlimited
+
+awk 'BEGIN {
+  for (i = 1; i < 2097152; i++) printf "%d %s ", i % 100, i % 2 ? "+" : "-"
+  print 1
+}' > $dir/sum.txt
+bench/gen_expr.sh 1048576 1 > $dir/expr.txt
+awk 'BEGIN {
+  for (i = 1; i <= 524288; i++)
+    printf "(%d + %d) * %d;\n", i % 1000, i % 7, i % 13
+}' > $dir/stmts.txt
+
+# Print the best time of the given passes over several runs, in milliseconds
+best_pass_ms() {
+  passes="$1"
+  shift
+  best=
+  for _ in $(seq $runs); do
+    ms=$(./c_compiler --time-passes "$@" 2>&1 > /dev/null |
+      awk -v passes="$passes" 'BEGIN { split(passes, p, ",") }
+        { for (i in p) if ($1 == p[i]) ms += $2 }
+        END { printf "%d", ms }')
+    if [ -z "$best" ] || [ $ms -lt $best ]; then best=$ms; fi
+  done
+  echo $best
+}
+
+# Print the best wall time of a command in milliseconds
+best_ms() {
+  best=
+  for _ in $(seq $runs); do
+    start=$(date +%s%N)
+    "$@" > /dev/null
+    end=$(date +%s%N)
+    ms=$(((end - start) / 1000000))
+    if [ -z "$best" ] || [ $ms -lt $best ]; then best=$ms; fi
+  done
+  echo $best
+}
+
+printf "%-8s %8s %8s %10s %8s %8s %8s %8s\n" input src-kb ast-kb \
+  lex+parse map tree src-O0 ast-O0
+for input in sum expr stmts; do
+  src=$dir/$input.txt
+  ast=$dir/$input.ast
+  ./c_compiler --emit-ast=bin --file=$src > $ast
+
+  printf "%-8s %8d %8d %10d %8d %8d %8d %8d\n" $input \
+    $(($(stat -c %s $src) / 1024)) $(($(stat -c %s $ast) / 1024)) \
+    "$(best_pass_ms tokenize,parse --file=$src)" \
+    "$(best_pass_ms map-ast --from-ast=$ast)" \
+    "$(best_pass_ms ast-tree -fpass=fold,gen --from-ast=$ast)" \
+    "$(best_ms ./c_compiler --file=$src)" \
+    "$(best_ms ./c_compiler --from-ast=$ast)"
+done
+
+rm -rf $dir
@@ -0,0 +1,138 @@
+#!/bin/bash -u
+
+# Check the generated code for regressions. Every case of
+# bench/codestats-cases.txt is compiled at -O0 and -O2 and, unless it is a
+# kernel, with -fpass=isel,sched, since -O2 folds the constant cases away.
+# Its instruction count, pushes and pops, assembled bytes and compile time are
+# compared with bench/codestats-baseline.txt. A case regresses when a count
+# grows by more than the threshold, or its compile time by more than the time
+# threshold and 1 ms, which keeps the noise of tiny cases out. Exits with 1 if
+# any case regresses.
+#
+# Compile times are the best --time-passes total of several runs, so they
+# leave out process start-up, but still depend on the machine: update the
+# baseline on the machine that checks it.
+#
+# Usage: codestats.sh [--threshold=PERCENT] [--time-threshold=PERCENT]
+#                     [--update]
+
+cd "$(dirname "$0")/.."
+
+threshold=0
+time_threshold=100
+update=false
+for arg in "$@"; do
+  case "$arg" in
+    --threshold=*) threshold="${arg#*=}" ;;
+    --time-threshold=*) time_threshold="${arg#*=}" ;;
+    --update) update=true ;;
+    *)
+      echo "usage: $0 [--threshold=PERCENT] [--time-threshold=PERCENT]" \
+        "[--update]" >&2
+      exit 2
+      ;;
+  esac
+done
+
+runs=3
+cases=bench/codestats-cases.txt
+baseline=bench/codestats-baseline.txt
+dir=tmp-codestats
+rm -rf $dir
+mkdir -p $dir
+
+# Deep expressions recurse deeply in the parser and code generator
+ulimit -s unlimited
+
+# Print the instructions, pushes and pops, bytes and best compile time in
+# milliseconds of the input in $dir/in.txt
+measure() {
+  best=
+  for _ in $(seq $runs); do
+    ./c_compiler "$@" --time-passes --file=$dir/in.txt > $dir/out.s \
+      2> $dir/err.txt || {
+      cat $dir/err.txt >&2
+      return 1
+    }
+    ms=$(awk '$1 == "total" { print $2 }' $dir/err.txt)
+    if [ -z "$best" ] || awk "BEGIN { exit !($ms < $best) }"; then
+      best=$ms
+    fi
+  done
+
+  insts=$(grep -c '^  [a-z]' $dir/out.s)
+  pushpop=$(grep -cE '^  (push|pop) ' $dir/out.s)
+  cc -c -o $dir/out.o $dir/out.s
+  bytes=$(size -A $dir/out.o | awk '$1 == ".text" { print $2 }')
+  echo $insts $pushpop $bytes $best
+}
+
+{
+  echo "# Generated by bench/codestats.sh --update"
+  echo "# case level insts push-pop bytes compile-ms"
+  while read -r name input; do
+    printf "%s" "$input" > $dir/in.txt
+    kernel=()
+    levels=(-O0 -O2 -fpass=isel,sched)
+    [[ $name == kernel-* ]] && kernel=(--kernel=f) levels=(-O0 -O2)
+    for level in "${levels[@]}"; do
+      row=$(measure $level "${kernel[@]}") || exit 1
+      echo $name $level $row
+    done
+  done < <(grep -v '^#' $cases)
+} > $dir/current.txt
+
+if $update; then
+  cp $dir/current.txt $baseline
+  echo "updated $baseline"
+  rm -rf $dir
+  exit 0
+fi
+
+# Join each case with its baseline, report every change and count the
+# regressions
+awk -v t="$threshold" -v tt="$time_threshold" '
+BEGIN {
+  printf "%-14s %-17s %8s %8s %8s %10s  %7s %7s %7s %8s\n", "case", "",
+    "insts", "push-pop", "bytes", "ms", "insts", "pp", "bytes", "ms"
+}
+function change(new, old) {
+  return old == 0 ? (new == 0 ? 0 : 100) : (new - old) * 100 / old
+}
+function check(metric, new, old, limit, slack,    d) {
+  d = change(new, old)
+  if (d > limit && new - old > slack) {
+    printf "  %s: %s -> %s (%+.1f%%)\n", metric, old, new, d
+    return 1
+  }
+  return 0
+}
+/^#/ { next }
+FNR == NR { base[$1 " " $2] = $0; next }
+{
+  key = $1 " " $2
+  printf "%-14s %-17s %8d %8d %8d %10.3f", $1, $2, $3, $4, $5, $6
+  if (!(key in base)) {
+    print "  new"
+    next
+  }
+  split(base[key], b, " ")
+  printf "  %+6.1f%% %+6.1f%% %+6.1f%% %+7.1f%%\n", change($3, b[3]),
+    change($4, b[4]), change($5, b[5]), change($6, b[6])
+  bad = check("instructions", $3, b[3], t, 0)
+  bad += check("pushes and pops", $4, b[4], t, 0)
+  bad += check("bytes", $5, b[5], t, 0)
+  bad += check("compile ms", $6, b[6], tt, 1)
+  if (bad) regressions++
+}
+END {
+  if (regressions) {
+    printf "%d case(s) regressed beyond %s%% (time %s%%)\n", regressions, t, tt
+    exit 1
+  }
+  print "no regressions"
+}' $baseline $dir/current.txt
+status=$?
+
+rm -rf $dir
+exit $status
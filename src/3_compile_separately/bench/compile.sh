@@ -0,0 +1,37 @@
+#!/bin/bash -u
+
+# Measure how long the compiler takes to generate code for large random
+# expressions, as the best of several runs, to compare builds of it.
+
+cd "$(dirname "$0")/.."
+
+runs=5
+dir=tmp-corpus
+rm -rf $dir
+bench/corpus.sh $dir
+
+# Deep expressions recurse deeply in the parser and code generator
+ulimit -s unlimited
+
+# Print the best wall time of a command in milliseconds
+best_ms() {
+  best=
+  for _ in $(seq $runs); do
+    start=$(date +%s%N)
+    "$@" > /dev/null
+    end=$(date +%s%N)
+    ms=$(((end - start) / 1000000))
+    if [ -z "$best" ] || [ $ms -lt $best ]; then best=$ms; fi
+  done
+  echo $best
+}
+
+printf "%8s %10s %10s %10s\n" leaves codegen-ms interp-ms kernel-ms
+for leaves in 4096 65536; do
+  printf "%8d %10d %10d %10d\n" $leaves \
+    "$(best_ms ./c_compiler --file=$dir/expr-$leaves-1.txt)" \
+    "$(best_ms ./c_compiler --interp --file=$dir/expr-$leaves-1.txt)" \
+    "$(best_ms ./c_compiler --kernel=f --file=$dir/cols-$leaves-1.txt)"
+done
+
+rm -rf $dir
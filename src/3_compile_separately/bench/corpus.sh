@@ -0,0 +1,18 @@
+#!/bin/bash -u
+
+# Write a corpus of random balanced expressions into a directory: plain ones
+# of growing size, and ones over input columns for kernels.
+#
+# Usage: corpus.sh DIR
+
+cd "$(dirname "$0")/.."
+
+dir="$1"
+mkdir -p "$dir"
+
+for leaves in 16 256 4096 65536; do
+  for seed in 1 2 3; do
+    bench/gen_expr.sh $leaves $seed > "$dir/expr-$leaves-$seed.txt"
+    bench/gen_expr.sh $leaves $seed 8 > "$dir/cols-$leaves-$seed.txt"
+  done
+done
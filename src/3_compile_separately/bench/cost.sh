@@ -0,0 +1,39 @@
+#!/bin/bash -u
+
+# Compare backend strategies by the cycles --cost-report estimates for each
+# expression of the benchmark corpus: the stack machine and --isel, each with
+# and without --sched.
+#
+# Usage: cost.sh [UARCH]
+
+cd "$(dirname "$0")/.."
+
+uarch="${1:-skylake}"
+dir=tmp-cost
+rm -rf $dir
+bench/corpus.sh $dir
+
+# Deep expressions recurse deeply in the parser and code generator
+ulimit -s unlimited
+
+# Print a metric of the cost report of a compilation
+metric() {
+  name="$1"
+  shift
+  ./c_compiler --cost-report=$uarch "$@" 2>&1 > /dev/null |
+    awk -v m="$name" 'index($0, m "  ") == 1 { print $NF }'
+}
+
+printf "%-14s %10s %12s %10s %12s %12s %12s\n" expression stack \
+  stack+sched isel isel+sched stack-bytes isel-bytes
+for file in $dir/expr-*.txt; do
+  printf "%-14s %10d %12d %10d %12d %12d %12d\n" "$(basename $file .txt)" \
+    "$(metric cycles --file=$file)" \
+    "$(metric cycles --sched=$uarch --file=$file)" \
+    "$(metric cycles --isel --file=$file)" \
+    "$(metric cycles --isel --sched=$uarch --file=$file)" \
+    "$(metric 'stack bytes' --file=$file)" \
+    "$(metric 'stack bytes' --isel --file=$file)"
+done
+
+rm -rf $dir
@@ -0,0 +1,40 @@
+#!/bin/bash -u
+
+# Compare the end-to-end latency of building an executable per expression
+# with the shell sequence that test.sh uses, c_compiler > tmp.s then cc, and
+# with the -o driver, which pipes the assembly into as and runs ld directly.
+# Prints the average milliseconds per expression of each.
+#
+# Usage: bench/driver.sh [EXPRESSIONS]
+
+cd "$(dirname "$0")/.."
+
+n="${1:-100}"
+dir=tmp-driver
+rm -rf $dir
+mkdir -p $dir
+
+for seed in $(seq $n); do
+  bench/gen_expr.sh 16 $seed > $dir/expr-$seed.txt
+done
+
+start=$(date +%s%N)
+for seed in $(seq $n); do
+  ./c_compiler --file=$dir/expr-$seed.txt > $dir/tmp.s
+  cc -o $dir/tmp $dir/tmp.s 2> /dev/null
+done
+end=$(date +%s%N)
+shell_us=$(((end - start) / 1000 / n))
+
+start=$(date +%s%N)
+for seed in $(seq $n); do
+  ./c_compiler -o $dir/tmp --file=$dir/expr-$seed.txt
+done
+end=$(date +%s%N)
+driver_us=$(((end - start) / 1000 / n))
+
+printf "%-14s %10s\n" build ms/expr
+printf "%-14s %10.2f\n" "> tmp.s; cc" $(awk "BEGIN { print $shell_us / 1000 }")
+printf "%-14s %10.2f\n" "-o" $(awk "BEGIN { print $driver_us / 1000 }")
+
+rm -rf $dir
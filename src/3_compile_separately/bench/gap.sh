@@ -0,0 +1,87 @@
+#!/bin/bash -u
+
+# Measure how far the generated code is from gcc -O2. Every expression of the
+# benchmark corpus is compiled by c_compiler with the given flags, and by gcc
+# -O2 as the body of "long f(void) { return ...; }" with each number passed
+# through an empty asm statement, so that gcc cannot fold it. The asm takes
+# the number in a register, so gcc pays a mov for each one that c_compiler
+# may use as an immediate: its instructions, bytes and time include loading
+# the operands, which favors c_compiler in the ratios. No barrier leaves an
+# immediate that gcc cannot see through. The function returns long, and gcc
+# uses -fwrapv, so that both compute the same 64-bit value, which is checked.
+# Both are linked into bench/perf.c to time them.
+#
+# Prints the instruction count, the code size and the time per call of each
+# and their ratios, then the expressions ranked by time ratio, worst first.
+# The default flags leave out fold, since gcc is not allowed to fold either.
+#
+# Usage: gap.sh [FLAGS...]
+
+cd "$(dirname "$0")/.."
+
+flags=("${@:--fpass=isel,sched}")
+dir=tmp-gap
+rm -rf $dir
+bench/corpus.sh $dir
+
+# Deep expressions recurse deeply in the parser and code generator
+ulimit -s unlimited
+
+# Print the number of instructions and the bytes of code of an object
+measure_obj() {
+  insts=$(objdump -d --no-show-raw-insn "$1" | grep -c '^ *[0-9a-f]*:	')
+  bytes=$(size -A "$1" | awk '$1 == ".text" { print $2 }')
+  echo $insts $bytes
+}
+
+# Print the result and the time per call of an object linked into perf.c
+run_obj() {
+  cc -O2 -Wl,-z,noexecstack -o $dir/perf bench/perf.c "$1"
+  $dir/perf $2 | awk '{ print $1, $2 }'
+}
+
+printf "flags: %s\n" "${flags[*]}"
+printf "gcc counts include a mov to a register for every number\n\n"
+printf "%-14s %9s %9s %6s %9s %9s %6s %9s %9s %6s\n" expression c-insts \
+  gcc-insts ratio c-bytes gcc-bytes ratio c-ns gcc-ns ratio
+: > $dir/rows.txt
+for leaves in 16 256 4096 65536; do
+  for seed in 1 2 3; do
+    name=expr-$leaves-$seed
+    iters=$((16777216 / leaves))
+
+    ./c_compiler "${flags[@]}" --file=$dir/$name.txt |
+      sed 's/\bmain\b/f/' > $dir/c.s
+    cc -c -o $dir/c.o $dir/c.s
+
+    {
+      echo '#define O(x) ({ long v = (x); __asm__("" : "+r"(v)); v; })'
+      printf "long f(void) { return "
+      sed -E 's/[0-9]+/O(&)/g' $dir/$name.txt
+      echo "; }"
+    } > $dir/gcc.c
+    gcc -O2 -fwrapv -c -o $dir/gcc.o $dir/gcc.c
+
+    read c_insts c_bytes <<< "$(measure_obj $dir/c.o)"
+    read gcc_insts gcc_bytes <<< "$(measure_obj $dir/gcc.o)"
+    read c_result c_ns <<< "$(run_obj $dir/c.o $iters)"
+    read gcc_result gcc_ns <<< "$(run_obj $dir/gcc.o $iters)"
+    if [ "$c_result" != "$gcc_result" ]; then
+      echo "$name: c_compiler computes $c_result, gcc $gcc_result"
+      exit 1
+    fi
+
+    echo $name $c_insts $gcc_insts $c_bytes $gcc_bytes $c_ns $gcc_ns |
+      awk '{ printf "%-14s %9d %9d %6.2f %9d %9d %6.2f %9.2f %9.2f %6.2f\n",
+             $1, $2, $3, $2 / $3, $4, $5, $4 / $5, $6, $7, $6 / $7 }' |
+      tee -a $dir/rows.txt
+  done
+done
+
+echo
+echo "worst offenders, by time ratio:"
+sort -k10,10 -g -r $dir/rows.txt |
+  awk '{ printf "%2d. %-14s %5.2fx time %5.2fx insts %5.2fx bytes\n",
+         NR, $1, $10, $4, $7 }'
+
+rm -rf $dir
@@ -0,0 +1,26 @@
+#!/bin/bash -u
+
+# Print a random balanced expression with the given number of leaves. If
+# COLUMNS is given, about half of the leaves are input columns c0, c1, ...
+# Divisors are always non-zero literals so that the expression never traps.
+#
+# Usage: gen_expr.sh LEAVES [SEED] [COLUMNS]
+
+leaves="$1"
+seed="${2:-1}"
+columns="${3:-0}"
+
+awk -v leaves="$leaves" -v seed="$seed" -v columns="$columns" '
+function gen(n,    l, op) {
+  if (n == 1 && columns > 0 && rand() < 0.5) return "c" int(rand() * columns)
+  if (n == 1) return int(rand() * 100)
+  l  = int(n / 2)
+  op = ops[int(rand() * nops) + 1]
+  if (op == "/") return "(" gen(n - 1) ") / " (int(rand() * 9) + 1)
+  return "(" gen(l) " " op " " gen(n - l) ")"
+}
+BEGIN {
+  srand(seed)
+  nops = split("+ - * / + - * == != < <= > >=", ops, " ")
+  print gen(leaves)
+}'
@@ -0,0 +1,59 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../c_compiler.h"
+
+/**
+ * Get the current time in nanoseconds.
+ *
+ * @return Monotonic time
+ */
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Evaluate an expression many times with the bytecode interpreter and with
+ * the tree-walking evaluator, and print the time per evaluation of each.
+ *
+ * Usage: interp EXPR ITERATIONS
+ */
+int main(int argc, char **argv) {
+  if (argc != 3) error("usage: %s EXPR ITERATIONS", argv[0]);
+
+  long iterations = atol(argv[2]);
+  user_input      = argv[1];
+  token           = tokenize();
+  Node *node      = program();
+  if (error_count > 0) {
+    print_diagnostics();
+    return 1;
+  }
+
+  Bytecode *bc = compile_bytecode(node);
+  int64_t vm_val, tree_val, sum = 0;
+
+  double start = now();
+  for (long i = 0; i < iterations; i++) {
+    run_bytecode(bc, &vm_val);
+    sum += vm_val;
+  }
+  double vm_ns = (now() - start) / iterations;
+
+  start = now();
+  for (long i = 0; i < iterations; i++) {
+    eval_tree(node, &tree_val);
+    sum += tree_val;
+  }
+  double tree_ns = (now() - start) / iterations;
+
+  if (vm_val != tree_val) error("value mismatch: %ld != %ld", vm_val, tree_val);
+  printf("%zu bytes of bytecode, vm %.1f ns, tree %.1f ns (checksum %ld)\n",
+         bc->len, vm_ns, tree_ns, (long)sum);
+  return 0;
+}
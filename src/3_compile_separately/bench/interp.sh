@@ -0,0 +1,34 @@
+#!/bin/bash -u
+
+# Compare the time to get the value of an expression through the native path
+# (compile, assemble, link, run), through --interp, and per evaluation with
+# the bytecode interpreter against the tree-walking evaluator.
+
+cd "$(dirname "$0")/.."
+
+runs=20
+
+# Print the average wall time of a command in milliseconds
+time_ms() {
+  start=$(date +%s%N)
+  for _ in $(seq $runs); do
+    "$@" > /dev/null 2>&1
+  done
+  end=$(date +%s%N)
+  echo $(((end - start) / runs / 1000))
+}
+
+native() {
+  ./c_compiler "$1" > tmp-bench.s && cc -o tmp-bench tmp-bench.s && ./tmp-bench
+}
+
+printf "%8s %12s %12s  %s\n" leaves native-us interp-us per-evaluation
+for leaves in 1 16 256 4096; do
+  expr=$(bench/gen_expr.sh $leaves)
+  iterations=$((10000000 / leaves))
+  printf "%8d %12d %12d  %s\n" $leaves "$(time_ms native "$expr")" \
+    "$(time_ms ./c_compiler --interp "$expr")" \
+    "$(bench/interp "$expr" $iterations)"
+done
+
+rm -f tmp-bench tmp-bench.s
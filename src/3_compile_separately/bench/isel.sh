@@ -0,0 +1,34 @@
+#!/bin/bash -u
+
+# Count the instructions that the stack machine code generator and --isel
+# generate for the benchmark corpus, per expression size, summed over the
+# seeds of each size.
+
+cd "$(dirname "$0")/.."
+
+dir=tmp-isel
+rm -rf $dir
+bench/corpus.sh $dir
+
+# Deep expressions recurse deeply in the parser and code generator
+ulimit -s unlimited
+
+# Print the number of instructions generated for a file
+count() {
+  ./c_compiler "$@" | grep -c '^  '
+}
+
+printf "%8s %12s %12s %8s\n" leaves stack isel ratio
+for leaves in 16 256 4096 65536; do
+  stack=0
+  isel=0
+  for seed in 1 2 3; do
+    file=$dir/expr-$leaves-$seed.txt
+    stack=$((stack + $(count --file=$file)))
+    isel=$((isel + $(count --isel --file=$file)))
+  done
+  printf "%8d %12d %12d %8s\n" $leaves $stack $isel \
+    "$(awk -v a=$isel -v b=$stack 'BEGIN { printf "%.2f", a / b }')"
+done
+
+rm -rf $dir
@@ -0,0 +1,68 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Kernels generated from the same expression with --kernel-isa=avx2 and
+// --kernel-isa=scalar
+void f_avx2(const int64_t **cols, int64_t *out, size_t n);
+void f_scalar(const int64_t **cols, int64_t *out, size_t n);
+
+/**
+ * Get the current time in seconds.
+ *
+ * @return Monotonic time
+ */
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Run a kernel over all rows several times and return the best rows/sec.
+ */
+static double measure(void (*f)(const int64_t **, int64_t *, size_t),
+                      const int64_t **cols, int64_t *out, size_t n) {
+  double best = 0;
+  for (int i = 0; i < 5; i++) {
+    double start = now();
+    f(cols, out, n);
+    double rate = n / (now() - start);
+    if (rate > best) best = rate;
+  }
+  return best;
+}
+
+/**
+ * Compare the AVX2 kernel against the scalar one over random columns.
+ *
+ * Usage: kernel ROWS
+ */
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+
+  const int64_t *cols[16];
+  srand(1);
+  for (int c = 0; c < 16; c++) {
+    int64_t *col = malloc(n * sizeof(int64_t));
+    for (size_t r = 0; r < n; r++) col[r] = rand() % 2001 - 1000;
+    cols[c] = col;
+  }
+
+  int64_t *expected = malloc(n * sizeof(int64_t));
+  int64_t *actual   = malloc(n * sizeof(int64_t));
+  double scalar     = measure(f_scalar, cols, expected, n);
+  double avx2       = measure(f_avx2, cols, actual, n);
+
+  if (memcmp(expected, actual, n * sizeof(int64_t))) {
+    fprintf(stderr, "kernel results differ\n");
+    return 1;
+  }
+
+  printf("%12.1f %12.1f %8.2fx\n", scalar / 1e6, avx2 / 1e6, avx2 / scalar);
+  return 0;
+}
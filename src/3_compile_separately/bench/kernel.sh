@@ -0,0 +1,21 @@
+#!/bin/bash -u
+
+# Compare rows/sec of AVX2 kernels against scalar ones for random expressions
+# over input columns, with and without division.
+
+cd "$(dirname "$0")/.."
+
+rows=4000000
+
+printf "%8s %6s %12s %12s %9s\n" leaves seed scalar-Mrows avx2-Mrows speedup
+for leaves in 4 16 64; do
+  for seed in 1 2 3; do
+    expr=$(bench/gen_expr.sh $leaves $seed 4)
+    ./c_compiler --kernel=f_avx2 "$expr" > tmp-avx2.s
+    ./c_compiler --kernel=f_scalar --kernel-isa=scalar "$expr" > tmp-scalar.s
+    cc -O2 -o tmp-kernel bench/kernel.c tmp-avx2.s tmp-scalar.s
+    printf "%8d %6d %s\n" $leaves $seed "$(./tmp-kernel $rows)"
+  done
+done
+
+rm -f tmp-kernel tmp-avx2.s tmp-scalar.s
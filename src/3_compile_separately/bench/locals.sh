@@ -0,0 +1,54 @@
+#!/bin/bash -u
+
+# Count the memory operations of programs with local variables when the most
+# used variables are promoted to callee-saved registers, and when every
+# variable stays in its frame slot (--frame-slots), at each optimization
+# level. Memory operations are pushes, pops and instructions with a memory
+# operand other than lea; the programs are straight-line, so each runs once.
+
+cd "$(dirname "$0")/.."
+
+dir=tmp-locals
+rm -rf $dir
+mkdir -p $dir
+
+# Write a program of statements v = a op b over some variables, the first few
+# of which are used far more often than the others, as loop counters and
+# accumulators are
+generate() {
+  awk -v vars=$1 -v stmts=$2 -v seed=$3 'BEGIN {
+    srand(seed)
+    for (i = 0; i < vars; i++) printf "v%d = %d; ", i, i + 1
+    split("+ - *", ops, " ")
+    for (i = 0; i < stmts; i++)
+      printf "v%d = v%d %s v%d; ", int(vars * rand() ^ 3), \
+        int(vars * rand() ^ 3), ops[int(3 * rand()) + 1], int(vars * rand() ^ 3)
+    print "v0 == v0"
+  }'
+}
+
+# Print the number of memory operations in the code generated for a file
+count() {
+  ./c_compiler "$@" |
+    awk '$1 == "push" || $1 == "pop" || ($1 != "lea" && /\[/)' | wc -l
+}
+
+printf "%6s %6s %6s %10s %10s %8s\n" vars stmts level slots promoted ratio
+for vars in 4 16 64; do
+  stmts=$((vars * 16))
+  for level in -O0 -O1 -O2; do
+    slots=0
+    promoted=0
+    for seed in 1 2 3; do
+      file=$dir/locals-$vars-$seed.txt
+      generate $vars $stmts $seed > $file
+      slots=$((slots + $(count $level --frame-slots --file=$file)))
+      promoted=$((promoted + $(count $level --file=$file)))
+    done
+    ratio=$(awk -v a=$promoted -v b=$slots 'BEGIN { printf "%.2f", a / b }')
+    printf "%6d %6d %6s %10d %10d %8s\n" $vars $stmts $level $slots \
+      $promoted $ratio
+  done
+done
+
+rm -rf $dir
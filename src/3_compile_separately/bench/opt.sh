@@ -0,0 +1,42 @@
+#!/bin/bash -u
+
+# Trade compile time against code quality: for each optimization level, the
+# best compile time of several runs and the cycles --cost-report estimates,
+# for random balanced expressions. These are all constants, which -O1 folds
+# away, so the -O1 and -O2 pipelines without fold are measured as well.
+
+cd "$(dirname "$0")/.."
+
+runs=3
+dir=tmp-opt
+rm -rf $dir
+mkdir -p $dir
+
+# Deep expressions recurse deeply in the parser and code generator
+ulimit -s unlimited
+
+# Print the best wall time of a command in milliseconds
+best_ms() {
+  best=
+  for _ in $(seq $runs); do
+    start=$(date +%s%N)
+    "$@" > /dev/null
+    end=$(date +%s%N)
+    ms=$(((end - start) / 1000000))
+    if [ -z "$best" ] || [ $ms -lt $best ]; then best=$ms; fi
+  done
+  echo $best
+}
+
+printf "%8s %-18s %12s %12s\n" leaves level compile-ms cycles
+for leaves in 4096 65536; do
+  bench/gen_expr.sh $leaves 1 > $dir/expr.txt
+  for level in -O0 -O1 -O2 -fpass=isel -fpass=isel,sched; do
+    cycles=$(./c_compiler $level --cost-report --file=$dir/expr.txt 2>&1 \
+      > /dev/null | awk '/^cycles/ { print $2 }')
+    printf "%8d %-18s %12d %12d\n" $leaves $level \
+      "$(best_ms ./c_compiler $level --file=$dir/expr.txt)" $cycles
+  done
+done
+
+rm -rf $dir
@@ -0,0 +1,50 @@
+#!/bin/bash -u
+
+# Compare code generation on 1, 2 and 4 threads (--jobs) on a long sum and a
+# random balanced expression of millions of nodes. Prints the best wall time
+# of several runs, and fails if the code differs from the sequential one.
+
+cd "$(dirname "$0")/.."
+
+runs=3
+dir=tmp-parallel
+rm -rf $dir
+mkdir -p $dir
+
+# Deep expressions recurse deeply in the parser and code generator
+ulimit -s unlimited
+
+awk 'BEGIN {
+  for (i = 1; i < 4194304; i++) printf "%d %s ", i % 100, i % 2 ? "+" : "-"
+  print 1
+}' > $dir/sum.txt
+bench/gen_expr.sh 2097152 1 > $dir/expr.txt
+
+# Print the best wall time of a command in milliseconds
+best_ms() {
+  best=
+  for _ in $(seq $runs); do
+    start=$(date +%s%N)
+    "$@" > /dev/null
+    end=$(date +%s%N)
+    ms=$(((end - start) / 1000000))
+    if [ -z "$best" ] || [ $ms -lt $best ]; then best=$ms; fi
+  done
+  echo $best
+}
+
+printf "%-8s %10s %10s %10s\n" input jobs=1-ms jobs=2-ms jobs=4-ms
+for input in sum expr; do
+  file=$dir/$input.txt
+  ./c_compiler --file=$file > $dir/seq.s
+  for jobs in 2 4; do
+    ./c_compiler --jobs=$jobs --file=$file | cmp -s - $dir/seq.s ||
+      { echo "$input: --jobs=$jobs differs from sequential code"; exit 1; }
+  done
+  printf "%-8s %10d %10d %10d\n" $input \
+    "$(best_ms ./c_compiler --file=$file)" \
+    "$(best_ms ./c_compiler --jobs=2 --file=$file)" \
+    "$(best_ms ./c_compiler --jobs=4 --file=$file)"
+done
+
+rm -rf $dir
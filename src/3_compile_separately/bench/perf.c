@@ -0,0 +1,95 @@
+#define _GNU_SOURCE
+
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// Generated main, renamed
+int64_t f(void);
+
+// Hardware counter read around the calls
+typedef struct {
+  char *name;       // Column name
+  uint32_t type;    // perf_event_attr type
+  uint64_t config;  // perf_event_attr config
+  int fd;           // Counter, or -1 if unavailable
+} Counter;
+
+static Counter counters[] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"insts", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"br-miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"l1d-miss", PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+         PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+};
+
+#define NUM_COUNTERS (sizeof(counters) / sizeof(*counters))
+
+/**
+ * Open a user-space counter of this thread, disabled.
+ *
+ * @param c Counter
+ */
+static void open_counter(Counter *c) {
+  struct perf_event_attr attr = {
+      .size           = sizeof(attr),
+      .type           = c->type,
+      .config         = c->config,
+      .disabled       = 1,
+      .exclude_kernel = 1,
+      .exclude_hv     = 1,
+  };
+  c->fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/**
+ * Get the monotonic time.
+ *
+ * @return Nanoseconds
+ */
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Call the generated code many times and print its result and, per call, the
+ * time and every hardware counter that perf_event_open() grants, or "-" for
+ * those it does not.
+ *
+ * Usage: perf [ITERATIONS]
+ */
+int main(int argc, char **argv) {
+  long iters     = argc > 1 ? atol(argv[1]) : 1000000;
+  int64_t result = f();
+
+  for (int i = 0; i < NUM_COUNTERS; i++) open_counter(&counters[i]);
+  for (int i = 0; i < NUM_COUNTERS; i++)
+    if (counters[i].fd >= 0) ioctl(counters[i].fd, PERF_EVENT_IOC_ENABLE, 0);
+
+  double start = now_ns();
+  for (long i = 0; i < iters; i++) f();
+  double ns = now_ns() - start;
+
+  for (int i = 0; i < NUM_COUNTERS; i++)
+    if (counters[i].fd >= 0) ioctl(counters[i].fd, PERF_EVENT_IOC_DISABLE, 0);
+
+  printf("%12ld %10.2f", (long)result, ns / iters);
+  for (int i = 0; i < NUM_COUNTERS; i++) {
+    uint64_t count;
+    if (counters[i].fd >= 0 &&
+        read(counters[i].fd, &count, sizeof(count)) == sizeof(count))
+      printf(" %10.2f", (double)count / iters);
+    else
+      printf(" %10s", "-");
+  }
+  printf("\n");
+  return 0;
+}
@@ -0,0 +1,37 @@
+#!/bin/bash -u
+
+# Measure how fast generated code runs. Every expression of the benchmark
+# corpus is compiled with the given flags, its main renamed to f and linked
+# into bench/perf.c, which calls it millions of times, fewer for the larger
+# ones, and reads the hardware counters per call through perf_event_open().
+# Counters the kernel does not grant print as "-"; the time per call from
+# clock_gettime() is always there.
+#
+# To compare compiler revisions, point COMPILER at another build and compare
+# the tables.
+#
+# Usage: [COMPILER=path] perf.sh [FLAGS...]
+
+cd "$(dirname "$0")/.."
+
+compiler="${COMPILER:-./c_compiler}"
+dir=tmp-perf
+rm -rf $dir
+bench/corpus.sh $dir
+
+# Deep expressions recurse deeply in the parser and code generator
+ulimit -s unlimited
+
+printf "%-14s %10s %12s %10s %10s %10s %10s %10s\n" expression iters result \
+  ns cycles insts br-miss l1d-miss
+for leaves in 16 256 4096 65536; do
+  for seed in 1 2 3; do
+    name=expr-$leaves-$seed
+    "$compiler" "$@" --file=$dir/$name.txt | sed 's/\bmain\b/f/' > $dir/f.s
+    cc -O2 -Wl,-z,noexecstack -o $dir/perf bench/perf.c $dir/f.s
+    iters=$((16777216 / leaves))
+    printf "%-14s %10d %s\n" $name $iters "$($dir/perf $iters)"
+  done
+done
+
+rm -rf $dir
@@ -0,0 +1,53 @@
+#!/bin/bash -u
+
+# Compare the sequential compiler with --pipeline on long sums, whose left
+# spine spans the whole input so that code is generated while parsing, and on
+# random balanced expressions, whose spine is short. Prints the best wall time
+# of several runs and the peak resident set size of each.
+
+cd "$(dirname "$0")/.."
+
+runs=5
+dir=tmp-pipeline
+rm -rf $dir
+mkdir -p $dir
+
+# Deep expressions recurse deeply in the parser and code generator
+ulimit -s unlimited
+
+for terms in 262144 1048576; do
+  awk -v n=$terms 'BEGIN {
+    for (i = 1; i < n; i++) printf "%d %s ", i % 100, i % 2 ? "+" : "-"
+    print 1
+  }' > $dir/sum-$terms.txt
+done
+bench/gen_expr.sh 262144 1 > $dir/expr-262144.txt
+
+# Print the best wall time of a command in milliseconds
+best_ms() {
+  best=
+  for _ in $(seq $runs); do
+    start=$(date +%s%N)
+    "$@" > /dev/null 2>&1
+    end=$(date +%s%N)
+    ms=$(((end - start) / 1000000))
+    if [ -z "$best" ] || [ $ms -lt $best ]; then best=$ms; fi
+  done
+  echo $best
+}
+
+# Print the peak resident set size of a compilation in kilobytes
+peak_kb() {
+  ./c_compiler --mem-report "$@" 2>&1 > /dev/null | awk '/^peak rss/ { print $3 }'
+}
+
+printf "%-16s %10s %10s %10s %10s\n" input seq-ms pipe-ms seq-kb pipe-kb
+for input in sum-262144 sum-1048576 expr-262144; do
+  file=$dir/$input.txt
+  printf "%-16s %10d %10d %10d %10d\n" $input \
+    "$(best_ms ./c_compiler --file=$file)" \
+    "$(best_ms ./c_compiler --pipeline --file=$file)" \
+    "$(peak_kb --file=$file)" "$(peak_kb --pipeline --file=$file)"
+done
+
+rm -rf $dir
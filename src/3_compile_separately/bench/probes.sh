@@ -0,0 +1,44 @@
+#!/bin/bash -u
+
+# Check that the USDT probes cost nothing when no tracer is attached: build
+# the compiler with and without them (-DNO_PROBES) and compare the best
+# compile time of large random expressions with each. Also prints how many
+# probe sites the build has; with no <sys/sdt.h>, both builds are the same.
+#
+# Usage: CC=cc CFLAGS=... bench/probes.sh
+
+cd "$(dirname "$0")/.."
+
+runs=7
+dir=tmp-probes
+rm -rf $dir
+bench/corpus.sh $dir
+
+${CC:-cc} ${CFLAGS:-} -o $dir/probes *.c || exit 1
+${CC:-cc} ${CFLAGS:-} -DNO_PROBES -o $dir/none *.c || exit 1
+echo "probe sites: $(readelf -n $dir/probes | grep -c stapsdt)"
+
+# Deep expressions recurse deeply in the parser and code generator
+ulimit -s unlimited
+
+# Print the best wall time of a command in milliseconds
+best_ms() {
+  best=
+  for _ in $(seq $runs); do
+    start=$(date +%s%N)
+    "$@" > /dev/null
+    end=$(date +%s%N)
+    ms=$(((end - start) / 1000000))
+    if [ -z "$best" ] || [ $ms -lt $best ]; then best=$ms; fi
+  done
+  echo $best
+}
+
+printf "%8s %10s %10s\n" leaves probes-ms none-ms
+for leaves in 4096 65536; do
+  file=$dir/expr-$leaves-1.txt
+  printf "%8d %10d %10d\n" $leaves "$(best_ms $dir/probes --file=$file)" \
+    "$(best_ms $dir/none --file=$file)"
+done
+
+rm -rf $dir
@@ -0,0 +1,50 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <x86intrin.h>
+
+// The same expression compiled without and with --sched, as functions
+int64_t f_base(void);
+int64_t f_sched(void);
+
+/**
+ * Measure the cycles of one call, as the fewest of many.
+ *
+ * @param f Function
+ *
+ * @return Cycles
+ */
+static uint64_t measure(int64_t (*f)(void)) {
+  uint64_t best = UINT64_MAX;
+  for (int i = 0; i < 20000; i++) {
+    uint64_t start = __rdtsc();
+    f();
+    uint64_t cycles = __rdtsc() - start;
+    if (cycles < best) best = cycles;
+  }
+  return best;
+}
+
+/**
+ * Compare the reference cycles of scheduled code against unscheduled code.
+ */
+int main(void) {
+  if (f_base() != f_sched()) {
+    fprintf(stderr, "results differ: %ld != %ld\n", (long)f_base(),
+            (long)f_sched());
+    return 1;
+  }
+
+  uint64_t empty = UINT64_MAX;
+  for (int i = 0; i < 20000; i++) {
+    uint64_t start  = __rdtsc();
+    uint64_t cycles = __rdtsc() - start;
+    if (cycles < empty) empty = cycles;
+  }
+
+  uint64_t base  = measure(f_base) - empty;
+  uint64_t sched = measure(f_sched) - empty;
+  printf("%10lu %10lu %8.2fx\n", (unsigned long)base, (unsigned long)sched,
+         (double)base / sched);
+  return 0;
+}
@@ -0,0 +1,23 @@
+#!/bin/bash -u
+
+# Compare the reference cycles of code scheduled by --sched for each
+# microarchitecture model against the unscheduled stack machine code, for
+# random balanced expressions.
+
+cd "$(dirname "$0")/.."
+
+printf "%8s %6s %8s %10s %10s %9s\n" leaves seed uarch base sched speedup
+for leaves in 16 64 256 1024; do
+  for seed in 1 2 3; do
+    expr=$(bench/gen_expr.sh $leaves $seed)
+    ./c_compiler "$expr" | sed 's/\bmain\b/f_base/' > tmp-base.s
+    for uarch in generic skylake zen3; do
+      ./c_compiler --sched=$uarch "$expr" | sed 's/\bmain\b/f_sched/' \
+        > tmp-sched.s
+      cc -O2 -Wl,-z,noexecstack -o tmp-sched bench/sched.c tmp-base.s tmp-sched.s
+      printf "%8d %6d %8s %s\n" $leaves $seed $uarch "$(./tmp-sched)"
+    done
+  done
+done
+
+rm -f tmp-sched tmp-base.s tmp-sched.s
@@ -0,0 +1,55 @@
+#!/bin/bash -u
+
+# Compile programs of up to 10M statements one statement at a time
+# (--per-statement, streamed with --stream) and, for the smaller ones, as a
+# whole. Prints the wall time and the peak resident set size of each, and
+# fails if compiling a statement at a time ever takes more than the ceiling,
+# which does not depend on the number of statements.
+#
+# Usage: bench/statements.sh [CEILING_KB]
+
+cd "$(dirname "$0")/.."
+
+ceiling_kb=${1:-8192}
+dir=tmp-statements
+rm -rf $dir
+mkdir -p $dir
+
+# Deep trees recurse deeply in the parser and code generator
+ulimit -s unlimited
+
+# Print the wall time in milliseconds and the peak resident set size in
+# kilobytes of a compilation
+measure() {
+  start=$(date +%s%N)
+  kb=$(./c_compiler --mem-report "$@" 2>&1 > /dev/null |
+    awk '/^peak rss/ { print $3 }')
+  end=$(date +%s%N)
+  echo $(((end - start) / 1000000)) $kb
+}
+
+status=0
+printf "%-10s %10s %10s %10s %10s\n" stmts whole-ms stmt-ms whole-kb stmt-kb
+for stmts in 100000 1000000 10000000; do
+  file=$dir/stmts-$stmts.txt
+  awk -v n=$stmts 'BEGIN {
+    for (i = 1; i <= n; i++) printf "(%d + %d) * %d;\n", i % 1000, i % 7, i % 13
+  }' > $file
+
+  whole_ms=- whole_kb=-
+  if [ $stmts -le 1000000 ]; then
+    read whole_ms whole_kb <<< "$(measure --file=$file)"
+  fi
+  read stmt_ms stmt_kb <<< "$(measure --per-statement --stream --file=$file)"
+  printf "%-10s %10s %10s %10s %10s\n" $stmts $whole_ms $stmt_ms $whole_kb \
+    $stmt_kb
+
+  if [ $stmt_kb -gt $ceiling_kb ]; then
+    echo "$stmts statements take $stmt_kb kb, over the $ceiling_kb kb ceiling"
+    status=1
+  fi
+  rm -f $file
+done
+
+rm -rf $dir
+exit $status
@@ -0,0 +1,46 @@
+#!/bin/bash -u
+
+# Compare reading the input whole with streaming it (--stream) on long sums of
+# growing size, both pipelined so that tokens and nodes are freed as code is
+# generated. Prints the wall time and the peak resident set size of each,
+# which stays flat with --stream. Pass sizes in megabytes to override the
+# default ones; sizes over 2048 exercise 64-bit offsets.
+#
+# Usage: bench/stream.sh [MB]...
+
+cd "$(dirname "$0")/.."
+
+dir=tmp-stream
+rm -rf $dir
+mkdir -p $dir
+
+# Deep expressions recurse deeply in the parser and code generator
+ulimit -s unlimited
+
+# Print the wall time in milliseconds and the peak resident set size in
+# kilobytes of a compilation
+measure() {
+  start=$(date +%s%N)
+  kb=$(./c_compiler --mem-report "$@" 2>&1 > /dev/null |
+    awk '/^peak rss/ { print $3 }')
+  end=$(date +%s%N)
+  echo $(((end - start) / 1000000)) $kb
+}
+
+printf "%-8s %10s %10s %10s %10s\n" mb whole-ms stream-ms whole-kb stream-kb
+for mb in ${@:-16 64 256}; do
+  file=$dir/sum-$mb.txt
+  # Every term is 6 bytes on average
+  awk -v n=$((mb * 1048576 / 6)) 'BEGIN {
+    for (i = 1; i < n; i++) printf "%d %s ", i % 1000, i % 2 ? "+" : "-"
+    print 1
+  }' > $file
+
+  read whole_ms whole_kb <<< "$(measure --pipeline --file=$file)"
+  read stream_ms stream_kb <<< "$(measure --pipeline --stream --file=$file)"
+  printf "%-8s %10d %10d %10d %10d\n" $mb $whole_ms $stream_ms $whole_kb \
+    $stream_kb
+  rm -f $file
+done
+
+rm -rf $dir
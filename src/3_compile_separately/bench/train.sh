@@ -0,0 +1,30 @@
+#!/bin/bash -u
+
+# Run the compiler over the corpus from corpus.sh in every mode, to collect a
+# profile for make pgo.
+
+cd "$(dirname "$0")/.."
+
+dir=tmp-corpus
+rm -rf $dir
+bench/corpus.sh $dir
+
+for file in $dir/expr-*.txt; do
+  ./c_compiler --file=$file > /dev/null
+  ./c_compiler --interp --file=$file > /dev/null
+  ./c_compiler --interp=tree --file=$file > /dev/null
+done
+for file in $dir/expr-16-* $dir/expr-256-*; do
+  ./c_compiler --sched --file=$file > /dev/null
+done
+for file in $dir/cols-*.txt; do
+  ./c_compiler --kernel=f --file=$file > /dev/null
+  ./c_compiler --kernel=f --kernel-isa=scalar --file=$file > /dev/null
+done
+
+# Exercise error recovery too
+for input in "1 +" "(1 + ) * (2 3) + (4 5)" "1 + # + (2 * ) + (3 + )"; do
+  ./c_compiler "$input" > /dev/null 2>&1
+done
+
+rm -rf $dir
@@ -1,11 +1,33 @@
 #include <ctype.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdnoreturn.h>
 #include <string.h>
 
+// Compiler version, printed by --version
+#define VERSION "0.1.0"
+
+/************************
+ * Tracing
+ ************************/
+
+// PROBE(name, args...) is a USDT probe c_compiler:name for bpftrace and perf,
+// with up to 12 integer or pointer arguments. It costs a nop when nothing is
+// attached. Without <sys/sdt.h>, or built with -DNO_PROBES, it is nothing at
+// all, and its arguments are not evaluated.
+#if !defined(NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define PROBE(...) STAP_PROBEV(c_compiler, __VA_ARGS__)
+#endif
+#endif
+#ifndef PROBE
+#define PROBE(...) ((void)0)
+#endif
+
 /************************
  * Token
  ************************/
@@ -13,34 +35,81 @@
 // Token kind
 typedef enum {
   TK_RESERVED,  // Symbol
+  TK_IDENT,     // Identifier
   TK_NUM,       // Integer token
   TK_EOF,       // End of input token
+  TK_INVALID,   // Run of invalid characters, never seen by the parser
 } TokenKind;
 
+// Punctuator
+typedef enum {
+  PUNCT_EQ,      // ==
+  PUNCT_NE,      // !=
+  PUNCT_LE,      // <=
+  PUNCT_GE,      // >=
+  PUNCT_LT,      // <
+  PUNCT_GT,      // >
+  PUNCT_ADD,     // +
+  PUNCT_SUB,     // -
+  PUNCT_MUL,     // *
+  PUNCT_DIV,     // /
+  PUNCT_LPAREN,  // (
+  PUNCT_RPAREN,  // )
+  PUNCT_SEMI,    // ;
+  PUNCT_ASSIGN,  // =
+} Punct;
+
 // Token
 typedef struct Token Token;
 struct Token {
   TokenKind kind;  // Token kind
   Token *next;     // Next token
   int val;         // If kind is TK_NUM, its value
-  char *str;       // Token string
-  int len;         // Token length
+  Punct punct;     // If kind is TK_RESERVED, its punctuator
+  char *str;       // Token string; only identifiers keep it when streamed
+  size_t len;      // Token length
+  size_t pos;      // Byte offset in the input
 };
 
-// Input program
+// Spelling of each punctuator
+extern char *punct_str[];
+
+// Input program, or NULL while it is streamed from a file
 extern char *user_input;
 
 // Current token
 extern Token *token;
 
+// Source of the token after one whose next is NULL, when tokens arrive in
+// chunks
+extern Token *(*next_token_chunk)(void);
+
+// Maximum number of diagnostics collected before giving up
+extern int max_errors;
+
+// Number of collected diagnostics
+extern int error_count;
+
+// True while the parser is skipping tokens after a syntax error
+extern bool panicking;
+
 noreturn void error(char *fmt, ...);
-noreturn void error_at(char *loc, char *fmt, ...);
-bool consume(char *op);
-void expect(char *op);
+noreturn void error_at(size_t pos, char *fmt, ...);
+void report_at(size_t pos, char *fmt, ...);
+void print_diagnostics(void);
+bool consume(Punct op);
+Token *consume_ident(void);
+Token *peek(void);
+void expect(Punct op);
 int expect_number(void);
+void expect_eof(void);
+void stream_input(char *path, size_t window);
+void lex_token(Token *tok);
 bool at_eof(void);
-Token *new_token(TokenKind kind, Token *cur, char *str, int len);
-bool starts_with(char *p, char *q);
+Token *tokenize_chunks(void);
+Token *tokenize_on_demand(void);
+size_t lex_tell(void);
+void lex_seek(size_t pos);
 Token *tokenize(void);
 
 /************************
@@ -49,37 +118,425 @@ Token *tokenize(void);
 
 // Node kind
 typedef enum {
-  NODE_ADD,  // +
-  NODE_SUB,  // -
-  NODE_MUL,  // *
-  NODE_DIV,  // /
-  NODE_EQ,   // ==
-  NODE_NE,   // !=
-  NODE_LT,   // <
-  NODE_LE,   // <=
-  NODE_NUM,  // Number
+  NODE_ADD,     // +
+  NODE_SUB,     // -
+  NODE_MUL,     // *
+  NODE_DIV,     // /
+  NODE_EQ,      // ==
+  NODE_NE,      // !=
+  NODE_LT,      // <
+  NODE_LE,      // <=
+  NODE_SEQ,     // ; with the value of the right-hand side
+  NODE_NUM,     // Number
+  NODE_COL,     // Input column
+  NODE_ASSIGN,  // = with a NODE_VAR on the left-hand side
+  NODE_VAR,     // Local variable
 } NodeKind;
 
 // Node
 typedef struct Node Node;
 struct Node {
   NodeKind kind;  // Node kind
+  int rule;       // Instruction pattern that covers the node, set by --isel
+  int facts;      // Facts about its value, by bit 1 << Fact, set by range
   Node *lhs;      // Left-hand side
   Node *rhs;      // Right-hand side
   int val;        // if kind equals NODE_NUM, it has a value
+  union {
+    int col;  // if kind equals NODE_COL, its column index
+    int var;  // if kind equals NODE_VAR, its local variable index
+  };
+};
+
+// Input column, an identifier bound to an int64_t array in kernel mode
+typedef struct Column Column;
+struct Column {
+  Column *next;  // Next column
+  char *name;    // Column name
+  size_t len;    // Column name length
+  int index;     // Index in the cols argument of the kernel
+  size_t pos;    // Offset of the first use, for diagnostics
 };
 
+// Input columns, in reverse order of first use
+extern Column *columns;
+
+// Part of the left spine of the program, i.e. of the chain of left-hand sides
+// from the root
+typedef enum {
+  SPINE_LEAF,  // Subtree at the bottom of the spine
+  SPINE_RHS,   // Binary whose lhs is the spine so far
+  SPINE_LHS,   // Binary whose rhs is the spine so far
+} SpineKind;
+
+// Called with each part of the left spine as soon as it is parsed, in the
+// order that gen() generates code for them; NULL to only build the tree
+extern void (*on_spine)(Node *node, SpineKind kind);
+
+// Arena nodes are allocated from, or NULL to allocate each on its own
+extern struct Arena *node_arena;
+
 Node *new_node(NodeKind kind);
 Node *new_binary(NodeKind kind, Node *lhs, Node *rhs);
 Node *new_num(int val);
+void free_node(Node *node);
+void free_tree(Node *node);
+Column *find_column(Token *tok);
+Node *program(void);
+Node *statement(void);
 Node *expr(void);
 
+/************************
+ * Local variables
+ ************************/
+
+// Local variable of main, declared by its first assignment
+typedef struct Var Var;
+struct Var {
+  Var *next;     // Next variable in the same hash bucket
+  char *name;    // Variable name
+  size_t len;    // Variable name length
+  int index;     // Index in locals
+  size_t pos;    // Offset of the first assignment, for diagnostics
+  int uses;      // Reads and writes left in the tree, set by layout_frame()
+  bool in_reg;   // Does it live in a callee-saved register
+  char loc[32];  // Operand it lives in, the register or a frame slot
+};
+
+// Local variables by index
+extern Var **locals;
+
+// Number of local variables
+extern int nlocals;
+
+Var *find_local(Token *tok);
+Var *declare_local(Token *tok);
+void layout_frame(Node *node);
+void gen_prologue(void);
+void gen_epilogue(void);
+
 /************************
  * Generate code
  ************************/
 
+// Assembly output stream of the calling thread
+extern _Thread_local FILE *output;
+
+void emit(char *fmt, ...);
 void pop(char *arg);
 void push(void);
 void ret(void);
 void gen_header(void);
+void gen_store(Node *var);
+void gen_binary(NodeKind kind);
 void gen(Node *node);
+void gen_parallel(Node *node, int jobs);
+
+/************************
+ * One-pass compiler
+ ************************/
+
+void gen_one_pass(void);
+
+/************************
+ * Kernel
+ ************************/
+
+void gen_kernel(Node *node, char *name, bool avx2);
+
+/************************
+ * Bytecode
+ ************************/
+
+// Bytecode opcode. OP_PUSH is followed by a 32-bit little-endian immediate.
+typedef enum {
+  OP_PUSH,  // Push an immediate
+  OP_ADD,   // +
+  OP_SUB,   // -
+  OP_MUL,   // *
+  OP_DIV,   // /
+  OP_EQ,    // ==
+  OP_NE,    // !=
+  OP_LT,    // <
+  OP_LE,    // <=
+  OP_SEQ,   // ;
+  OP_RET,   // Return the top of the stack
+} Opcode;
+
+// Bytecode
+typedef struct {
+  uint8_t *code;  // Instructions
+  size_t len;     // Length of code
+  size_t cap;     // Capacity of code
+  int max_depth;  // Operand stack depth needed to run the code
+} Bytecode;
+
+Bytecode *compile_bytecode(Node *node);
+bool run_bytecode(Bytecode *bc, int64_t *result);
+bool eval_tree(Node *node, int64_t *result);
+int exit_with_value(bool ok, int64_t val);
+
+/************************
+ * Compilation cache
+ ************************/
+
+// Cache directory, or NULL if caching is disabled
+extern char *cache_dir;
+
+// Cache size limit in bytes
+extern size_t cache_limit;
+
+bool cache_load(char *flags, FILE *out);
+void cache_store(char *buf, size_t len);
+void cache_print_stats(void);
+
+/************************
+ * Instruction scheduling
+ ************************/
+
+// General purpose register family, e.g. REG_RAX covers RAX, EAX and AL
+typedef enum {
+  REG_RAX,
+  REG_RCX,
+  REG_RDX,
+  REG_RBX,
+  REG_RSP,
+  REG_RBP,
+  REG_RSI,
+  REG_RDI,
+  REG_R8,
+  REG_R9,
+  REG_R10,
+  REG_R11,
+  REG_R12,
+  REG_R13,
+  REG_R14,
+  REG_R15,
+  REG_FLAGS,  // Not a register family; tracked as one for dependencies
+} Reg;
+
+// Number of general purpose register families
+#define NUM_REGS REG_FLAGS
+
+// Instruction class, which determines latency and throughput
+typedef enum {
+  CLS_MOV,     // Register to register or immediate move
+  CLS_ALU,     // add, sub, cmp and the like
+  CLS_LEA,     // lea
+  CLS_LOAD,    // Load from memory
+  CLS_STORE,   // Store to memory
+  CLS_IMUL,    // Multiplication
+  CLS_CQO,     // Sign extension into RDX
+  CLS_DIV,     // Division
+  CLS_DIV32,   // Division of 32-bit operands
+  CLS_SETCC,   // setcc
+  CLS_MOVZX,   // Zero or sign extension
+  CLS_BRANCH,  // Jump or return
+  NUM_CLASSES,
+} InstClass;
+
+// Cost of an instruction class
+typedef struct {
+  int latency;        // Cycles until the result can be used
+  double throughput;  // Cycles between two independent issues
+  uint32_t ports;     // Execution ports it can issue to, by bit 1 << port
+} Cost;
+
+// Number of execution ports a microarchitecture model may use
+#define NUM_PORTS 8
+
+// Microarchitecture model
+typedef struct {
+  char *name;              // Name
+  int width;               // Instructions issued per cycle
+  Cost cost[NUM_CLASSES];  // Cost of each instruction class
+} Uarch;
+
+// Assembly instruction
+typedef struct {
+  char op[16];      // Mnemonic
+  char arg[3][48];  // Operands
+  int nargs;        // Number of operands
+  InstClass cls;    // Instruction class
+  uint32_t uses;    // Registers read, by bit 1 << Reg
+  uint32_t defs;    // Registers written
+  uint32_t fixed;   // Registers that cannot be renamed
+  int slot;         // Stack slot [rsp + slot] accessed, or -1 if unknown
+  bool loads;       // Does it read memory
+  bool stores;      // Does it write memory
+  bool terminator;  // Does it end a basic block
+} Inst;
+
+extern Uarch uarchs[];
+
+Uarch *find_uarch(char *name);
+bool parse_inst(char *line, Inst *inst);
+bool analyze_inst(Inst *inst);
+char *schedule(char *text, size_t *len, Uarch *uarch);
+void cost_report(char *text, Uarch *uarch);
+
+/************************
+ * Instruction selection
+ ************************/
+
+void gen_isel(Node *node, Uarch *uarch);
+
+/************************
+ * Value ranges
+ ************************/
+
+// Fact about the value of a node that the range pass proves
+typedef enum {
+  FACT_BOOL,  // It is 0 or 1
+  FACT_U32,   // It is in [0, UINT32_MAX], so it fits a 32-bit register
+} Fact;
+
+// Rewrite that a proven range allows, counted by --rewrite-stats
+typedef enum {
+  REWRITE_CONST,   // Subtree with a known value, replaced by a number
+  REWRITE_TEST,    // Boolean compared with 0 or 1, replaced by itself
+  REWRITE_DEAD,    // Statement without effect, dropped
+  REWRITE_DIV32,   // 64-bit idiv done as a 32-bit div
+  REWRITE_IMUL32,  // 64-bit multiplication done in 32 bits
+  REWRITE_MOVZB,   // Boolean only compared, left in AL without movzb
+  NUM_REWRITES,
+} Rewrite;
+
+Node *narrow_ranges(Node *node);
+bool has_fact(Node *node, Fact fact);
+void count_rewrite(Rewrite rewrite);
+void print_rewrite_stats(void);
+
+/************************
+ * Pass manager
+ ************************/
+
+// Options of the passes
+typedef struct {
+  Uarch *uarch;      // Microarchitecture to schedule for and cost patterns by
+  int jobs;          // Threads to generate code on
+  char *dump_after;  // Pass to dump the tree or assembly after, or "all"
+  bool frame_slots;  // Keep every local variable in its frame slot
+} PassOptions;
+
+extern PassOptions pass_options;
+
+Node *fold(Node *node);
+bool select_passes(char *names);
+bool select_opt_level(int level);
+void use_pass(char *name);
+bool has_pass(char *name);
+bool has_ast_passes(void);
+bool has_asm_passes(void);
+double pass_clock(void);
+void pass_timed(char *name, double start);
+void dump_tree_after(char *name, Node *node);
+Node *run_ast_passes(Node *node);
+void run_codegen(Node *node);
+void run_codegen_statement(Node *node);
+char *run_asm_passes(char *text, size_t *len);
+void print_pass_times(void);
+
+/************************
+ * Memory accounting
+ ************************/
+
+// What an allocation is for
+typedef enum {
+  MEM_INPUT,     // Source text read from a file
+  MEM_TOKEN,     // Tokens
+  MEM_NODE,      // Nodes
+  MEM_COLUMN,    // Input columns
+  MEM_LOCAL,     // Local variables and their hash table
+  MEM_DIAG,      // Diagnostics and the line index
+  MEM_BYTECODE,  // Bytecode
+  MEM_SCHED,     // Instruction scheduler work space
+  MEM_CODEGEN,   // Parallel code generator work space
+  MEM_OUTPUT,    // Generated assembly
+  NUM_MEM_CATEGORIES,
+} MemCategory;
+
+// Bump allocator for memory that is freed all at once
+typedef struct ArenaBlock ArenaBlock;
+typedef struct Arena Arena;
+struct Arena {
+  MemCategory cat;     // What the memory is for
+  ArenaBlock *blocks;  // Blocks allocated from, the current one first
+  size_t used;         // Bytes used in the current block
+  size_t live;         // Bytes allocated since the last reset
+};
+
+void mem_count(MemCategory cat, size_t size);
+void *mem_alloc(MemCategory cat, size_t size);
+void *mem_realloc(MemCategory cat, void *p, size_t old_size, size_t size);
+void mem_free(MemCategory cat, void *p, size_t size);
+void *arena_alloc(Arena *arena, size_t size);
+void arena_reset(Arena *arena);
+void *mem_thread_begin(void);
+void mem_thread_merge(void *thread);
+void mem_phase(char *name);
+void mem_print_report(void);
+
+/************************
+ * Binary AST
+ ************************/
+
+// A binary AST file is an AstHeader followed by the nodes in post-order, the
+// input columns by index and the bytes of their names. Integers are
+// little-endian and nodes refer to each other by index, so that a mapped file
+// is walked as is. Node kinds are NodeKind values; AST_VERSION changes with
+// them.
+#define AST_MAGIC "CCAST\0\0"
+#define AST_VERSION 1
+
+// Binary AST header
+typedef struct {
+  char magic[8];      // AST_MAGIC
+  uint32_t version;   // AST_VERSION
+  uint32_t reserved;  // Zero
+  uint64_t nodes;     // Number of nodes, the root last
+  uint64_t columns;   // Number of input columns
+  uint64_t names;     // Bytes of column names
+} AstHeader;
+
+// Binary AST node
+typedef struct {
+  uint32_t kind;  // Node kind
+  int32_t val;    // Value of a number, or index of an input column
+  uint32_t lhs;   // Index of the left-hand side of a binary
+  uint32_t rhs;   // Index of the right-hand side of a binary
+} AstNode;
+
+// Binary AST input column
+typedef struct {
+  uint64_t name;  // Offset of the name in the names
+  uint64_t len;   // Name length
+} AstColumn;
+
+// Mapped binary AST
+typedef struct {
+  AstHeader *header;  // Header, at the start of the mapping
+  AstNode *nodes;     // Nodes
+  AstColumn *cols;    // Input columns
+  char *names;        // Column names
+  size_t size;        // Mapping size
+} Ast;
+
+void write_ast(FILE *out, Node *node);
+Ast *map_ast(char *path);
+Node *ast_tree(Ast *ast);
+void gen_ast(Ast *ast);
+
+/************************
+ * Pipeline
+ ************************/
+
+void pipeline_start(void);
+void pipeline_finish(void);
+
+/************************
+ * Driver
+ ************************/
+
+FILE *driver_start(char *path, bool link);
+int driver_finish(int status);
@@ -0,0 +1,306 @@
+#define _DEFAULT_SOURCE
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "c_compiler.h"
+
+char *cache_dir;
+size_t cache_limit = 256 << 20;
+
+// Cache statistics, persisted in <cache_dir>/stats
+typedef struct {
+  uint64_t hits;     // Number of lookups that found an entry
+  uint64_t misses;   // Number of lookups that did not
+  uint64_t entries;  // Number of stored entries
+  uint64_t bytes;    // Total size of stored entries
+} CacheStats;
+
+// Path of the entry for the current compilation
+static char entry_path[4096];
+
+/**
+ * Mix a 64-bit word into a hash state.
+ *
+ * @param h Hash state
+ * @param v Word
+ *
+ * @return New hash state
+ */
+static uint64_t mix(uint64_t h, uint64_t v) {
+  h ^= v * 0x9e3779b97f4a7c15;
+  h = (h << 31 | h >> 33) * 0xbf58476d1ce4e5b9;
+  return h;
+}
+
+/**
+ * Finalize a hash state so that every input bit affects every output bit.
+ *
+ * @param h Hash state
+ *
+ * @return Hash
+ */
+static uint64_t finalize(uint64_t h) {
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111eb;
+  return h ^ (h >> 31);
+}
+
+/**
+ * Hash a byte string into two independent 64-bit lanes, eight bytes at a time.
+ *
+ * @param h Hash state of two lanes
+ * @param p Bytes
+ * @param len Number of bytes
+ */
+static void hash_bytes(uint64_t h[2], char *p, size_t len) {
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t v;
+    memcpy(&v, p + i, 8);
+    h[0] = mix(h[0], v);
+    h[1] = mix(h[1], v ^ 0xff51afd7ed558ccd);
+  }
+
+  uint64_t v = 0;
+  memcpy(&v, p + i, len - i);
+  h[0] = mix(h[0], v ^ len);
+  h[1] = mix(h[1], v ^ ~len);
+}
+
+/**
+ * Identify the build of the compiler by the file of its executable and the
+ * time it was written, as ccache does by default. This is part of the cache
+ * key, so that entries stored by another build, which may generate different
+ * code, are never found; a version would have to be bumped by hand with every
+ * change to code generation. A rebuild writes a new executable, so it misses
+ * even if nothing changed, which is safe.
+ *
+ * @param id Set to the identity
+ */
+static void build_id(uint64_t id[4]) {
+  struct stat st;
+  if (stat("/proc/self/exe", &st) != 0)
+    error("cannot identify the compiler executable for the cache key");
+  id[0] = st.st_dev;
+  id[1] = st.st_ino;
+  id[2] = st.st_size;
+  id[3] = st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec;
+}
+
+/**
+ * Open the statistics file and lock it exclusively.
+ *
+ * @param stats Set to the current statistics
+ *
+ * @return File descriptor, or -1 on failure
+ */
+static int lock_stats(CacheStats *stats) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/stats", cache_dir);
+
+  memset(stats, 0, sizeof(*stats));
+  int fd = open(path, O_RDWR | O_CREAT, 0666);
+  if (fd < 0) return -1;
+  flock(fd, LOCK_EX);
+  if (pread(fd, stats, sizeof(*stats), 0) != sizeof(*stats))
+    memset(stats, 0, sizeof(*stats));
+  return fd;
+}
+
+/**
+ * Write the statistics back and release the lock.
+ *
+ * @param fd File descriptor returned by lock_stats()
+ * @param stats Statistics
+ */
+static void unlock_stats(int fd, CacheStats *stats) {
+  if (fd < 0) return;
+  pwrite(fd, stats, sizeof(*stats), 0);
+  close(fd);
+}
+
+/**
+ * Look up the assembly for the current input and flags, and write it out if
+ * it is cached by this build of the compiler.
+ *
+ * @param flags Command line options that affect code generation
+ * @param out Output stream
+ *
+ * @return Was the entry found
+ */
+bool cache_load(char *flags, FILE *out) {
+  uint64_t id[4];
+  build_id(id);
+  uint64_t h[2] = {0x243f6a8885a308d3, 0x13198a2e03707344};
+  hash_bytes(h, (char *)id, sizeof(id));
+  hash_bytes(h, flags, strlen(flags) + 1);
+  hash_bytes(h, user_input, strlen(user_input));
+  h[0] = finalize(h[0]);
+  h[1] = finalize(h[1]);
+
+  // Entries are sharded into 256 directories by the first byte of the hash
+  snprintf(entry_path, sizeof(entry_path), "%s/%02x/%016lx%016lx.s", cache_dir,
+           (unsigned)(h[0] >> 56), (unsigned long)h[0], (unsigned long)h[1]);
+
+  mkdir(cache_dir, 0777);
+
+  CacheStats stats;
+  bool found = false;
+  int fd     = open(entry_path, O_RDONLY);
+  struct stat st;
+  if (fd >= 0 && fstat(fd, &st) == 0) {
+    void *p = NULL;
+    if (st.st_size) p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED) {
+      fwrite(p, 1, st.st_size, out);
+      PROBE(flush, st.st_size);
+      if (p) munmap(p, st.st_size);
+
+      // Touch the entry so that eviction sees it as recently used
+      futimens(fd, NULL);
+      found = true;
+    }
+  }
+  if (fd >= 0) close(fd);
+
+  int sfd = lock_stats(&stats);
+  if (found)
+    stats.hits++;
+  else
+    stats.misses++;
+  unlock_stats(sfd, &stats);
+  return found;
+}
+
+// Cache entry seen during eviction
+typedef struct {
+  char path[4096];        // Entry path
+  off_t size;             // Entry size
+  struct timespec mtime;  // Last use
+} Entry;
+
+/**
+ * Compare entries by last use, oldest first.
+ *
+ * @param a Entry
+ * @param b Entry
+ *
+ * @return Negative, zero or positive as a was used before, with or after b
+ */
+static int compare_entries(const void *a, const void *b) {
+  struct timespec x = ((Entry *)a)->mtime, y = ((Entry *)b)->mtime;
+  if (x.tv_sec != y.tv_sec)
+    return (x.tv_sec > y.tv_sec) - (x.tv_sec < y.tv_sec);
+  return (x.tv_nsec > y.tv_nsec) - (x.tv_nsec < y.tv_nsec);
+}
+
+/**
+ * Remove least recently used entries until the cache is 10% below cache_limit,
+ * so that the directory walk is not repeated on every store. Also recounts the
+ * statistics, which concurrent writers may have skewed.
+ *
+ * @param stats Statistics to update
+ */
+static void evict(CacheStats *stats) {
+  size_t len = 0, cap = 1024;
+  Entry *entries = malloc(cap * sizeof(Entry));
+  uint64_t total = 0;
+
+  for (int shard = 0; shard < 256; shard++) {
+    char dir[4096];
+    snprintf(dir, sizeof(dir), "%s/%02x", cache_dir, shard);
+    DIR *d = opendir(dir);
+    if (!d) continue;
+
+    struct dirent *de;
+    while ((de = readdir(d))) {
+      // Skip "." and "..", and temporary files still being written
+      if (de->d_name[0] == '.' || !strncmp(de->d_name, "tmp.", 4)) continue;
+      if (len == cap) {
+        cap *= 2;
+        entries = realloc(entries, cap * sizeof(Entry));
+      }
+
+      Entry *e = &entries[len];
+      snprintf(e->path, sizeof(e->path), "%s/%s", dir, de->d_name);
+      struct stat st;
+      if (stat(e->path, &st) != 0) continue;
+      e->size  = st.st_size;
+      e->mtime = st.st_mtim;
+      total += st.st_size;
+      len++;
+    }
+    closedir(d);
+  }
+
+  qsort(entries, len, sizeof(Entry), compare_entries);
+  size_t i = 0;
+  for (; i < len && total > cache_limit - cache_limit / 10; i++) {
+    unlink(entries[i].path);
+    total -= entries[i].size;
+  }
+
+  stats->entries = len - i;
+  stats->bytes   = total;
+  free(entries);
+}
+
+/**
+ * Store the assembly for the current compilation. The entry is written to a
+ * temporary file first and renamed into place, so readers never see a partial
+ * entry.
+ *
+ * @param buf Assembly
+ * @param len Assembly length
+ */
+void cache_store(char *buf, size_t len) {
+  char dir[4096], tmp[4096];
+  int dir_len = strrchr(entry_path, '/') - entry_path;
+  snprintf(dir, sizeof(dir), "%.*s", dir_len, entry_path);
+  mkdir(dir, 0777);
+
+  snprintf(tmp, sizeof(tmp), "%s/tmp.XXXXXX", dir);
+  int fd = mkstemp(tmp);
+  if (fd < 0) return;
+
+  bool ok = write(fd, buf, len) == (ssize_t)len;
+  ok      = close(fd) == 0 && ok;
+  if (!ok || rename(tmp, entry_path) != 0) {
+    unlink(tmp);
+    return;
+  }
+
+  CacheStats stats;
+  int sfd = lock_stats(&stats);
+  stats.entries++;
+  stats.bytes += len;
+  if (stats.bytes > cache_limit) evict(&stats);
+  unlock_stats(sfd, &stats);
+}
+
+/**
+ * Print cache statistics to stderr.
+ */
+void cache_print_stats(void) {
+  CacheStats stats;
+  int sfd = lock_stats(&stats);
+  unlock_stats(sfd, &stats);
+
+  uint64_t lookups = stats.hits + stats.misses;
+  fprintf(stderr,
+          "cache: %lu hits, %lu misses (%.1f%% hit rate), %lu entries, "
+          "%lu/%zu bytes\n",
+          (unsigned long)stats.hits, (unsigned long)stats.misses,
+          lookups ? 100.0 * stats.hits / lookups : 0.0,
+          (unsigned long)stats.entries, (unsigned long)stats.bytes,
+          cache_limit);
+}
@@ -3,90 +3,144 @@
 
 #include "c_compiler.h"
 
+_Thread_local FILE *output;
+
+/**
+ * Write assembly code to the output stream.
+ *
+ * @param fmt Format
+ * @param ... Format arguments
+ */
+void emit(char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(output, fmt, ap);
+  va_end(ap);
+}
+
 /**
  * Pop the stack.
  *
  * @param arg Register
  */
 void pop(char *arg) {
-  printf("  pop %s\n", arg);
+  emit("  pop %s\n", arg);
 }
 
 /**
  * Push the stack.
  */
 void push(void) {
-  printf("  push rax\n");
+  emit("  push rax\n");
 }
 
 /**
- * Return from the function.
+ * Return from the function, through the epilogue if it has a frame.
  */
 void ret(void) {
-  printf("  ret\n");
+  gen_epilogue();
+  emit("  ret\n");
 }
 
 /**
- * Generate assembly code header.
+ * Generate assembly code header, and the prologue if main has a frame.
  */
 void gen_header(void) {
-  printf(".intel_syntax noprefix\n");
-  printf(".global main\n");
-  printf("main:\n");
+  emit(".intel_syntax noprefix\n");
+  emit(".global main\n");
+  emit("main:\n");
+  gen_prologue();
 }
 
 /**
- * Generate assembly code.
+ * Store the value at the top of the stack into a local variable, leaving it
+ * there as the value of the assignment.
  *
- * @param node Parsed node
+ * @param var Variable node
  */
-void gen(Node *node) {
-  if (node->kind == NODE_NUM) {
-    printf("  push %d\n", node->val);
-    return;
-  }
-
-  gen(node->lhs);
-  gen(node->rhs);
-
-  pop("rdi");
+void gen_store(Node *var) {
   pop("rax");
+  emit("  mov %s, rax\n", locals[var->var]->loc);
+  push();
+}
 
-  switch (node->kind) {
+/**
+ * Generate a binary operation on RAX and RDI, leaving the result in RAX.
+ *
+ * @param kind Node kind
+ */
+void gen_binary(NodeKind kind) {
+  switch (kind) {
     case NODE_ADD:
-      printf("  add rax, rdi\n");
+      emit("  add rax, rdi\n");
       break;
     case NODE_SUB:
-      printf("  sub rax, rdi\n");
+      emit("  sub rax, rdi\n");
       break;
     case NODE_MUL:
-      printf("  imul rdi\n");
+      emit("  imul rdi\n");
       break;
     case NODE_DIV:
-      printf("  cqo\n");       // Convert RAX(64bit) to RDX:RAX(128bit)
-      printf("  idiv rdi\n");  // RAX=RAX/RDI, RDX=RAX%RDI
+      emit("  cqo\n");       // Convert RAX(64bit) to RDX:RAX(128bit)
+      emit("  idiv rdi\n");  // RAX=RAX/RDI, RDX=RAX%RDI
       break;
     case NODE_EQ:
-      printf("  cmp rax, rdi\n");  // Comparison result is set to FLAGS register
-      printf("  sete al\n");       // Set AL(lower 8 bits of RAX) to 1 if equal
-      printf("  movzb rax, al\n");  // Zero clear upper 56 bits of RAX
+      emit("  cmp rax, rdi\n");  // Comparison result is set to FLAGS register
+      emit("  sete al\n");       // Set AL(lower 8 bits of RAX) to 1 if equal
+      emit("  movzb rax, al\n");  // Zero clear upper 56 bits of RAX
       break;
     case NODE_NE:
-      printf("  cmp rax, rdi\n");
-      printf("  setne al\n");
-      printf("  movzb rax, al\n");
+      emit("  cmp rax, rdi\n");
+      emit("  setne al\n");
+      emit("  movzb rax, al\n");
       break;
     case NODE_LT:
-      printf("  cmp rax, rdi\n");
-      printf("  setl al\n");
-      printf("  movzb rax, al\n");
+      emit("  cmp rax, rdi\n");
+      emit("  setl al\n");
+      emit("  movzb rax, al\n");
       break;
     case NODE_LE:
-      printf("  cmp rax, rdi\n");
-      printf("  setle al\n");
-      printf("  movzb rax, al\n");
+      emit("  cmp rax, rdi\n");
+      emit("  setle al\n");
+      emit("  movzb rax, al\n");
+      break;
+    case NODE_SEQ:
+      emit("  mov rax, rdi\n");
       break;
   }
+}
+
+/**
+ * Generate assembly code.
+ *
+ * @param node Parsed node
+ */
+void gen(Node *node) {
+  PROBE(gen, node->kind);
+  if (node->kind == NODE_NUM) {
+    emit("  push %d\n", node->val);
+    return;
+  }
 
+  if (node->kind == NODE_VAR) {
+    // The scheduler only lowers pushes of registers and immediates
+    Var *var = locals[node->var];
+    if (!var->in_reg) emit("  mov rax, %s\n", var->loc);
+    emit("  push %s\n", var->in_reg ? var->loc : "rax");
+    return;
+  }
+
+  if (node->kind == NODE_ASSIGN) {
+    gen(node->rhs);
+    gen_store(node->lhs);
+    return;
+  }
+
+  gen(node->lhs);
+  gen(node->rhs);
+
+  pop("rdi");
+  pop("rax");
+  gen_binary(node->kind);
   push();
 }
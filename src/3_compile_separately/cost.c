@@ -0,0 +1,208 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "c_compiler.h"
+
+// Cost model state while walking the instruction stream
+typedef struct {
+  Uarch *uarch;                 // Microarchitecture
+  long insts;                   // Instructions seen
+  long unmodeled;               // Instructions the model does not understand
+  long cycles;                  // Cycle the last result is ready
+  long critical_path;           // Longest chain of dependent latencies
+  double port_busy[NUM_PORTS];  // Cycles each port was busy
+  long port_free[NUM_PORTS];    // Cycle each port is free again
+  long ready[REG_FLAGS + 1];    // Cycle each register is ready
+  long chain[REG_FLAGS + 1];    // Critical path up to each register
+  long *slot_ready;             // Cycle each stack slot is ready
+  long *slot_chain;             // Critical path up to each stack slot
+  size_t nslots;                // Number of stack slots tracked
+  long rsp;                     // RSP relative to its value on entry
+  long stack_loads;             // Loads from the stack
+  long stack_stores;            // Stores to the stack
+} Model;
+
+/**
+ * Get the stack slot below the entry RSP that an address is in, growing the
+ * slot arrays as needed.
+ *
+ * @param m Model
+ * @param addr Address relative to the entry RSP
+ *
+ * @return Slot index, or -1 if the address is at or above the entry RSP
+ */
+static long find_slot(Model *m, long addr) {
+  if (addr >= 0) return -1;
+
+  size_t slot = (-addr - 1) / 8;
+  if (slot >= m->nslots) {
+    size_t n      = slot * 2 + 16;
+    m->slot_ready = mem_realloc(MEM_SCHED, m->slot_ready,
+                                m->nslots * sizeof(long), n * sizeof(long));
+    m->slot_chain = mem_realloc(MEM_SCHED, m->slot_chain,
+                                m->nslots * sizeof(long), n * sizeof(long));
+    for (size_t i = m->nslots; i < n; i++)
+      m->slot_ready[i] = m->slot_chain[i] = 0;
+    m->nslots = n;
+  }
+  return slot;
+}
+
+/**
+ * Issue an instruction once its operands are ready, on the port of its class
+ * that frees up first, but no earlier than the front end delivers it.
+ *
+ * @param m Model
+ * @param cls Instruction class
+ * @param ready Cycle its operands are ready
+ *
+ * @return Cycle its result is ready
+ */
+static long issue(Model *m, InstClass cls, long ready) {
+  Cost *c    = &m->uarch->cost[cls];
+  long start = m->insts++ / m->uarch->width;
+  if (ready > start) start = ready;
+
+  // A class on k ports that issues every t cycles keeps one busy for k*t
+  int port = -1;
+  for (int p = 0; p < NUM_PORTS; p++) {
+    if (!(c->ports & 1u << p)) continue;
+    if (port < 0 || m->port_free[p] < m->port_free[port]) port = p;
+  }
+
+  if (port >= 0) {
+    double busy = c->throughput * __builtin_popcount(c->ports);
+    if (m->port_free[port] > start) start = m->port_free[port];
+    m->port_free[port] = start + (busy < 1 ? 1 : (long)busy);
+    m->port_busy[port] += busy;
+  }
+
+  long done = start + c->latency;
+  if (done > m->cycles) m->cycles = done;
+  return done;
+}
+
+/**
+ * Model an analyzed instruction.
+ *
+ * @param m Model
+ * @param inst Instruction
+ */
+static void model_inst(Model *m, Inst *inst) {
+  long ready = 0, chain = 0;
+  for (int r = 0; r <= REG_FLAGS; r++) {
+    if (!(inst->uses & 1u << r) || r == REG_RSP) continue;
+    if (m->ready[r] > ready) ready = m->ready[r];
+    if (m->chain[r] > chain) chain = m->chain[r];
+  }
+
+  // Memory dependencies only go through stack slots
+  long slot = inst->slot >= 0 ? find_slot(m, m->rsp + inst->slot) : -1;
+  if (slot >= 0 && inst->loads) {
+    if (m->slot_ready[slot] > ready) ready = m->slot_ready[slot];
+    if (m->slot_chain[slot] > chain) chain = m->slot_chain[slot];
+  }
+  m->stack_loads += inst->slot >= 0 && inst->loads;
+  m->stack_stores += inst->slot >= 0 && inst->stores;
+
+  long done = issue(m, inst->cls, ready);
+  chain += m->uarch->cost[inst->cls].latency;
+  if (chain > m->critical_path) m->critical_path = chain;
+
+  for (int r = 0; r <= REG_FLAGS; r++) {
+    if (!(inst->defs & 1u << r)) continue;
+    m->ready[r] = done;
+    m->chain[r] = chain;
+  }
+  if (slot >= 0 && inst->stores) {
+    m->slot_ready[slot] = done;
+    m->slot_chain[slot] = chain;
+  }
+}
+
+/**
+ * Model push and pop as a store and a load of the slot at the top of the
+ * stack. The stack engine updates RSP for them without a uop.
+ *
+ * @param m Model
+ * @param inst Instruction
+ */
+static void model_push_pop(Model *m, Inst *inst) {
+  bool push = !strcmp(inst->op, "push");
+  if (push) m->rsp -= 8;
+
+  Inst mov = {.nargs = 2};
+  strcpy(mov.op, "mov");
+  snprintf(mov.arg[push ? 0 : 1], sizeof(mov.arg[0]), "qword ptr [rsp]");
+  strcpy(mov.arg[push ? 1 : 0], inst->arg[0]);
+  if (analyze_inst(&mov)) {
+    model_inst(m, &mov);
+  } else {
+    m->unmodeled++;
+    issue(m, push ? CLS_STORE : CLS_LOAD, 0);
+  }
+
+  if (!push) m->rsp += 8;
+}
+
+/**
+ * Estimate without running it how long generated assembly takes, and print
+ * the estimate to stderr. The front end delivers as many instructions per
+ * cycle as the microarchitecture issues, and each executes as soon as its
+ * operands are ready and a port of its class is free, with no limit on how
+ * far it runs ahead. Dependencies go through registers, flags and stack
+ * slots. Control flow is not modeled, so the code is taken to run once from
+ * top to bottom.
+ *
+ * @param text Assembly
+ * @param uarch Microarchitecture
+ */
+void cost_report(char *text, Uarch *uarch) {
+  Model m = {.uarch = uarch};
+
+  for (char *line = text; *line;) {
+    char *end = strchr(line, '\n');
+    if (end) *end = '\0';
+
+    Inst inst;
+    if (parse_inst(line, &inst)) {
+      if (!strcmp(inst.op, "push") || !strcmp(inst.op, "pop")) {
+        model_push_pop(&m, &inst);
+      } else if (analyze_inst(&inst)) {
+        model_inst(&m, &inst);
+        if (!strcmp(inst.arg[0], "rsp") && isdigit(inst.arg[1][0]))
+          m.rsp += (inst.op[0] == 'a' ? 1 : -1) * atol(inst.arg[1]);
+      } else {
+        m.unmodeled++;
+        issue(&m, CLS_ALU, 0);
+      }
+    }
+
+    if (!end) break;
+    *end = '\n';
+    line = end + 1;
+  }
+
+  int busiest = 0;
+  for (int p = 1; p < NUM_PORTS; p++)
+    if (m.port_busy[p] > m.port_busy[busiest]) busiest = p;
+
+  fprintf(stderr, "%-16s %12s\n", "cost model", uarch->name);
+  fprintf(stderr, "%-16s %12ld\n", "instructions", m.insts);
+  fprintf(stderr, "%-16s %12ld\n", "cycles", m.cycles);
+  fprintf(stderr, "%-16s %12ld\n", "critical path", m.critical_path);
+  fprintf(stderr, "%-16s %12ld\n", "issue bound",
+          (m.insts + uarch->width - 1) / uarch->width);
+  fprintf(stderr, "%-16s %9.0f p%d\n", "busiest port", m.port_busy[busiest],
+          busiest);
+  fprintf(stderr, "%-16s %12ld\n", "stack loads", m.stack_loads);
+  fprintf(stderr, "%-16s %12ld\n", "stack stores", m.stack_stores);
+  fprintf(stderr, "%-16s %12ld\n", "stack bytes",
+          (m.stack_loads + m.stack_stores) * 8);
+  fprintf(stderr, "%-16s %12ld\n", "unmodeled", m.unmodeled);
+
+  mem_free(MEM_SCHED, m.slot_ready, m.nslots * sizeof(long));
+  mem_free(MEM_SCHED, m.slot_chain, m.nslots * sizeof(long));
+}
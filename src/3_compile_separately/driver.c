@@ -0,0 +1,157 @@
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "c_compiler.h"
+
+extern char **environ;
+
+// Output file, removed unless driver_finish() succeeds
+static char *out_path;
+
+// Link an executable rather than stop at an object file
+static bool link_exe;
+
+// The assembler, reading the generated code from a pipe
+static pid_t as_pid;
+static FILE *as_input;
+
+// Object file in memory that the assembler writes and the linker reads, or -1
+// when the assembler writes the output file itself
+static int obj_fd = -1;
+
+/**
+ * Remove the output file of a driver run that has not succeeded, and stop the
+ * assembler. Run at exit, so that an error anywhere leaves nothing behind.
+ */
+static void clean_up(void) {
+  if (!out_path) return;
+  if (as_pid > 0) {
+    kill(as_pid, SIGKILL);
+    waitpid(as_pid, NULL, 0);
+  }
+  unlink(out_path);
+}
+
+/**
+ * Start a program.
+ *
+ * @param argv Program and arguments
+ * @param actions File actions to spawn it with, or NULL
+ *
+ * @return Process ID
+ */
+static pid_t spawn(char **argv, posix_spawn_file_actions_t *actions) {
+  pid_t pid;
+  int err = posix_spawnp(&pid, argv[0], actions, NULL, argv, environ);
+  if (err) error("cannot run %s: %s", argv[0], strerror(err));
+  return pid;
+}
+
+/**
+ * Wait for a program to exit.
+ *
+ * @param pid Process ID
+ * @param name Program name
+ *
+ * @return Did it succeed
+ */
+static bool wait_for(pid_t pid, char *name) {
+  int status;
+  while (waitpid(pid, &status, 0) < 0)
+    if (errno != EINTR) error("cannot wait for %s: %s", name, strerror(errno));
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/**
+ * Start assembling the generated code into an object file or an executable.
+ * The code is written into a pipe to the assembler, which writes the object
+ * file into memory when it is to be linked, so that no temporary file is
+ * made. The output file is removed if compilation fails.
+ *
+ * @param path Output file
+ * @param link Link an executable rather than stop at an object file
+ *
+ * @return Stream to write the assembly to
+ */
+FILE *driver_start(char *path, bool link) {
+  out_path = path;
+  link_exe = link;
+  atexit(clean_up);
+
+  // An assembler that exits early must fail the compilation, not kill it
+  signal(SIGPIPE, SIG_IGN);
+
+  char obj[32];
+  if (link) {
+    // memfd_create(), which glibc only declares along with register names
+    // that clash with ours
+    obj_fd = syscall(SYS_memfd_create, "object", 0);
+    if (obj_fd < 0)
+      error("cannot create an object file: %s", strerror(errno));
+    snprintf(obj, sizeof(obj), "/proc/self/fd/%d", obj_fd);
+  }
+
+  int fds[2];
+  if (pipe(fds) < 0) error("cannot create a pipe: %s", strerror(errno));
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, fds[0], STDIN_FILENO);
+  posix_spawn_file_actions_addclose(&actions, fds[0]);
+  posix_spawn_file_actions_addclose(&actions, fds[1]);
+
+  char *argv[] = {"as", "--64", "-o", link ? obj : path, NULL};
+  as_pid = spawn(argv, &actions);
+  posix_spawn_file_actions_destroy(&actions);
+  close(fds[0]);
+
+  as_input = fdopen(fds[1], "w");
+  if (!as_input) error("cannot write to the assembler: %s", strerror(errno));
+  return as_input;
+}
+
+/**
+ * Finish assembling, and link the executable with an entry point that exits
+ * with the value main returns, so that no C runtime is needed.
+ *
+ * @param status Exit status of the compilation
+ *
+ * @return Exit status
+ */
+int driver_finish(int status) {
+  if (status != 0) return status;
+
+  if (link_exe)
+    fprintf(as_input,
+            ".global _start\n"
+            "_start:\n"
+            "  call main\n"
+            "  mov edi, eax\n"
+            "  mov eax, 60\n"
+            "  syscall\n");
+  fprintf(as_input, ".section .note.GNU-stack,\"\",@progbits\n");
+  fclose(as_input);
+
+  bool ok = wait_for(as_pid, "as");
+  as_pid  = 0;
+  if (!ok) return 1;
+
+  if (link_exe) {
+    char obj[32];
+    snprintf(obj, sizeof(obj), "/proc/self/fd/%d", obj_fd);
+    char *argv[] = {"ld", "-o", out_path, obj, NULL};
+    if (!wait_for(spawn(argv, NULL), "ld")) return 1;
+    close(obj_fd);
+  }
+
+  out_path = NULL;
+  return 0;
+}
@@ -0,0 +1,126 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "c_compiler.h"
+
+/**
+ * Compute a binary of two numbers as the generated code would, in 64 bits.
+ *
+ * @param kind Node kind
+ * @param a Left-hand side
+ * @param b Right-hand side
+ * @param val Set to the value
+ *
+ * @return False if the code would trap
+ */
+static bool compute(NodeKind kind, int64_t a, int64_t b, int64_t *val) {
+  switch (kind) {
+    case NODE_ADD:
+      *val = a + b;
+      return true;
+    case NODE_SUB:
+      *val = a - b;
+      return true;
+    case NODE_MUL:
+      *val = a * b;
+      return true;
+    case NODE_DIV:
+      if (b == 0) return false;
+      *val = a / b;
+      return true;
+    case NODE_EQ:
+      *val = a == b;
+      return true;
+    case NODE_NE:
+      *val = a != b;
+      return true;
+    case NODE_LT:
+      *val = a < b;
+      return true;
+    case NODE_LE:
+      *val = a <= b;
+      return true;
+    default:
+      return false;
+  }
+}
+
+/**
+ * Replace a binary by one of its operands, freeing the other.
+ *
+ * @param node Binary
+ * @param keep Operand to keep
+ *
+ * @return The operand
+ */
+static Node *replace(Node *node, Node *keep) {
+  free_tree(keep == node->lhs ? node->rhs : node->lhs);
+  free_node(node);
+  return keep;
+}
+
+/**
+ * Check if a node is a given number.
+ *
+ * @param node Node
+ * @param val Number
+ *
+ * @return Is it
+ */
+static bool is_val(Node *node, int val) {
+  return node->kind == NODE_NUM && node->val == val;
+}
+
+/**
+ * Fold constant subexpressions and drop operations by an identity element:
+ * x + 0, 0 + x, x - 0, x * 1, 1 * x and x / 1, as well as statements other
+ * than the last that are a number. Constants are only folded when the result
+ * fits in a number node, and divisions by zero are left to trap at run time.
+ * Operations that discard an operand, such as x * 0, are kept, since the
+ * operand might trap.
+ *
+ * @param node Tree
+ *
+ * @return Folded tree
+ */
+Node *fold(Node *node) {
+  if (!node->lhs) return node;
+  node->lhs = fold(node->lhs);
+  node->rhs = fold(node->rhs);
+  Node *lhs = node->lhs, *rhs = node->rhs;
+
+  int64_t val;
+  if (lhs->kind == NODE_NUM && rhs->kind == NODE_NUM &&
+      compute(node->kind, lhs->val, rhs->val, &val) && val >= INT32_MIN &&
+      val <= INT32_MAX) {
+    free_tree(lhs);
+    free_tree(rhs);
+    *node = (Node){.kind = NODE_NUM, .val = val};
+    return node;
+  }
+
+  switch (node->kind) {
+    case NODE_ADD:
+      if (is_val(rhs, 0)) return replace(node, lhs);
+      if (is_val(lhs, 0)) return replace(node, rhs);
+      break;
+    case NODE_SUB:
+      if (is_val(rhs, 0)) return replace(node, lhs);
+      break;
+    case NODE_MUL:
+      if (is_val(rhs, 1)) return replace(node, lhs);
+      if (is_val(lhs, 1)) return replace(node, rhs);
+      break;
+    case NODE_DIV:
+      if (is_val(rhs, 1)) return replace(node, lhs);
+      break;
+    case NODE_SEQ:
+      // A number has no effect as a statement
+      if (lhs->kind == NODE_NUM) return replace(node, rhs);
+      break;
+    default:
+      break;
+  }
+  return node;
+}
@@ -0,0 +1,536 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "c_compiler.h"
+
+// Tree pattern that covers a node, and how its value gets into RAX. Operands
+// are "x" for the left-hand side, "y" for the right-hand side and "c" for a
+// number.
+typedef enum {
+  RULE_NUM,            // c: mov rax, c
+  RULE_BIN,            // x op y: y; push; x; pop rdi; op rax, rdi
+  RULE_BIN_NUM_LHS,    // c op y: y; mov rdi, rax; mov rax, c; op rax, rdi
+  RULE_IMM,            // x op c: x; op rax, c
+  RULE_IMM_SWAP,       // c cmp y: y; cmp rax, c with the condition mirrored
+  RULE_NEG,            // 0 - y: y; neg rax
+  RULE_RSUB,           // c - y: y; neg rax; add rax, c
+  RULE_LEA_SCALE,      // x * 2|3|4|5|8|9: x; lea rax, [rax+rax*2] and the like
+  RULE_LEA_ADD,        // (x + y) + c: y; push; x; pop rdi; lea rax, [rax+rdi+c]
+  RULE_LEA_SCALE_ADD,  // x * 3 + c and the like: x; lea rax, [rax+rax*2+c]
+  RULE_SEQ,            // x; y: x; y
+  RULE_VAR,            // v: mov rax, v
+  RULE_ASSIGN,         // v = y: y; mov v, rax
+  RULE_BIN_VAR,        // x op v: x; mov rdi, v; op rax, rdi
+  RULE_BIN_VAR_LHS,    // v op y: y; mov rdi, rax; mov rax, v; op rax, rdi
+  RULE_BIN_IN_ORDER,   // x op y: x; push; y; mov rdi, rax; pop rax; op rax, rdi
+} Rule;
+
+// What evaluating a subtree does to local variables, by bit
+enum {
+  EFFECT_READ  = 1,  // Reads one
+  EFFECT_WRITE = 2,  // Assigns one
+};
+
+// Latencies that covers are costed by
+static Uarch *model;
+
+/**
+ * Get the cost of an instruction class.
+ *
+ * @param cls Instruction class
+ *
+ * @return Latency in cycles
+ */
+static long cost(InstClass cls) {
+  return model->cost[cls].latency;
+}
+
+/**
+ * Check if a node is a number.
+ *
+ * @param node Node
+ *
+ * @return Is it a number
+ */
+static bool is_num(Node *node) {
+  return node->kind == NODE_NUM;
+}
+
+/**
+ * Check if a node is a local variable.
+ *
+ * @param node Node
+ *
+ * @return Is it a local variable
+ */
+static bool is_var(Node *node) {
+  return node->kind == NODE_VAR;
+}
+
+/**
+ * Check if two subtrees must be evaluated in source order, because one of
+ * them assigns a local variable that the other may use.
+ *
+ * @param x Effects of the first
+ * @param y Effects of the second
+ *
+ * @return Must they
+ */
+static bool ordered(int x, int y) {
+  return (x & EFFECT_WRITE && y) || (y & EFFECT_WRITE && x);
+}
+
+/**
+ * Get the cost of moving a local variable to or from a register.
+ *
+ * @param node Variable node
+ * @param store Is it a store to the variable
+ *
+ * @return Cost
+ */
+static long var_cost(Node *node, bool store) {
+  if (locals[node->var]->in_reg) return cost(CLS_MOV);
+  return cost(store ? CLS_STORE : CLS_LOAD);
+}
+
+/**
+ * Check if a multiplication by a number can be done by lea.
+ *
+ * @param val Multiplier
+ *
+ * @return Is it 2, 3, 4, 5, 8 or 9
+ */
+static bool is_lea_scale(int val) {
+  return val == 2 || val == 3 || val == 4 || val == 5 || val == 8 || val == 9;
+}
+
+/**
+ * Check if a binary is a comparison.
+ *
+ * @param kind Node kind
+ *
+ * @return Is it a comparison
+ */
+static bool is_cmp(NodeKind kind) {
+  return kind == NODE_EQ || kind == NODE_NE || kind == NODE_LT ||
+         kind == NODE_LE;
+}
+
+/**
+ * Check if a division can be done in 32 bits, because the range pass has
+ * proven that both operands fit in an unsigned 32-bit register.
+ *
+ * @param node Binary
+ *
+ * @return Can it
+ */
+static bool is_div32(Node *node) {
+  return node->kind == NODE_DIV && has_fact(node->lhs, FACT_U32) &&
+         has_fact(node->rhs, FACT_U32);
+}
+
+/**
+ * Check if a comparison can compare the low bytes of its operands, because
+ * the range pass has proven that both are booleans.
+ *
+ * @param node Binary
+ *
+ * @return Can it
+ */
+static bool is_byte_cmp(Node *node) {
+  return is_cmp(node->kind) && has_fact(node->lhs, FACT_BOOL) &&
+         has_fact(node->rhs, FACT_BOOL);
+}
+
+/**
+ * Get the cost of the instructions that combine the operands of a binary in
+ * RAX and RDI, or in RAX and an immediate.
+ *
+ * @param node Binary
+ *
+ * @return Cost
+ */
+static long op_cost(Node *node) {
+  switch (node->kind) {
+    case NODE_MUL:
+      return cost(CLS_IMUL);
+    case NODE_DIV:
+      if (is_div32(node)) return cost(CLS_ALU) + cost(CLS_DIV32);
+      return cost(CLS_CQO) + cost(CLS_DIV);
+    case NODE_ADD:
+    case NODE_SUB:
+      return cost(CLS_ALU);
+    default:
+      return cost(CLS_ALU) + cost(CLS_SETCC) + cost(CLS_MOVZX);
+  }
+}
+
+/**
+ * Get the cost of the instructions a rule emits for a node itself, leaving out
+ * the operands it reduces.
+ *
+ * @param node Node
+ * @param rule Rule
+ *
+ * @return Cost
+ */
+static long rule_cost(Node *node, Rule rule) {
+  switch (rule) {
+    case RULE_NUM:
+      return cost(CLS_MOV);
+    case RULE_BIN:
+      return cost(CLS_STORE) + cost(CLS_LOAD) + op_cost(node);
+    case RULE_BIN_NUM_LHS:
+      return 2 * cost(CLS_MOV) + op_cost(node);
+    case RULE_IMM:
+      // Division needs the divisor in a register
+      return (node->kind == NODE_DIV ? cost(CLS_MOV) : 0) + op_cost(node);
+    case RULE_IMM_SWAP:
+      return op_cost(node);
+    case RULE_NEG:
+      return cost(CLS_ALU);
+    case RULE_RSUB:
+      return 2 * cost(CLS_ALU);
+    case RULE_LEA_SCALE:
+    case RULE_LEA_SCALE_ADD:
+      return cost(CLS_LEA);
+    case RULE_LEA_ADD:
+      return cost(CLS_STORE) + cost(CLS_LOAD) + cost(CLS_LEA);
+    case RULE_SEQ:
+      return 0;
+    case RULE_VAR:
+      return var_cost(node, false);
+    case RULE_ASSIGN:
+      return var_cost(node->lhs, true);
+    case RULE_BIN_VAR:
+      return var_cost(node->rhs, false) + op_cost(node);
+    case RULE_BIN_VAR_LHS:
+      return cost(CLS_MOV) + var_cost(node->lhs, false) + op_cost(node);
+    case RULE_BIN_IN_ORDER:
+      return cost(CLS_STORE) + cost(CLS_MOV) + cost(CLS_LOAD) + op_cost(node);
+  }
+  return 0;
+}
+
+/**
+ * Choose the cheapest cover of a tree, bottom-up, and record the rule chosen
+ * for each node in it. Commutative binaries with a number on the left are
+ * swapped first so that the number is on the right. Operands are evaluated
+ * in source order where one assigns a local variable that the other uses.
+ *
+ * @param node Tree
+ * @param effects Set to what evaluating the tree does to local variables
+ *
+ * @return Cost of the cover
+ */
+static long label(Node *node, int *effects) {
+  *effects = 0;
+  if (is_num(node)) {
+    node->rule = RULE_NUM;
+    return rule_cost(node, RULE_NUM);
+  }
+
+  if (is_var(node)) {
+    node->rule = RULE_VAR;
+    *effects   = EFFECT_READ;
+    return rule_cost(node, RULE_VAR);
+  }
+
+  NodeKind kind = node->kind;
+  if (kind == NODE_ASSIGN) {
+    node->rule = RULE_ASSIGN;
+    long y     = label(node->rhs, effects);
+    *effects |= EFFECT_WRITE;
+    return y + rule_cost(node, RULE_ASSIGN);
+  }
+
+  // Statements are covered one after the other
+  int fx, fy;
+  if (kind == NODE_SEQ) {
+    node->rule = RULE_SEQ;
+    long x     = label(node->lhs, &fx);
+    long y     = label(node->rhs, &fy);
+    *effects   = fx | fy;
+    return x + y;
+  }
+
+  if ((kind == NODE_ADD || kind == NODE_MUL || kind == NODE_EQ ||
+       kind == NODE_NE) &&
+      is_num(node->lhs) && !is_num(node->rhs)) {
+    Node *tmp = node->lhs;
+    node->lhs = node->rhs;
+    node->rhs = tmp;
+  }
+
+  Node *lhs = node->lhs, *rhs = node->rhs;
+  long x = label(lhs, &fx), y = label(rhs, &fy);
+  *effects = fx | fy;
+
+  // Every binary can be covered by the generic rule, which evaluates the
+  // right-hand side first unless the operands must be evaluated in order
+  Rule best      = ordered(fx, fy) ? RULE_BIN_IN_ORDER : RULE_BIN;
+  long best_cost = x + y + rule_cost(node, best);
+  Rule rules[4];
+  long costs[4];
+  int n = 0;
+
+  if (is_num(rhs)) {
+    rules[n]   = RULE_IMM;
+    costs[n++] = x + rule_cost(node, RULE_IMM);
+    if (kind == NODE_MUL && is_lea_scale(rhs->val)) {
+      rules[n]   = RULE_LEA_SCALE;
+      costs[n++] = x + rule_cost(node, RULE_LEA_SCALE);
+    }
+
+    // Fold the constant into the lea of the left-hand side
+    if (kind == NODE_ADD && lhs->kind == NODE_ADD && lhs->rule == RULE_BIN) {
+      rules[n]   = RULE_LEA_ADD;
+      costs[n++] = x - rule_cost(lhs, RULE_BIN) + rule_cost(node, RULE_LEA_ADD);
+    }
+    if (kind == NODE_ADD && lhs->rule == RULE_LEA_SCALE) {
+      rules[n]   = RULE_LEA_SCALE_ADD;
+      costs[n++] = x - rule_cost(lhs, RULE_LEA_SCALE) +
+                   rule_cost(node, RULE_LEA_SCALE_ADD);
+    }
+  } else if (is_num(lhs)) {
+    if (kind == NODE_SUB && lhs->val == 0) {
+      rules[n]   = RULE_NEG;
+      costs[n++] = y + rule_cost(node, RULE_NEG);
+    } else if (kind == NODE_SUB) {
+      rules[n]   = RULE_RSUB;
+      costs[n++] = y + rule_cost(node, RULE_RSUB);
+    } else if (is_cmp(kind)) {
+      rules[n]   = RULE_IMM_SWAP;
+      costs[n++] = y + rule_cost(node, RULE_IMM_SWAP);
+    }
+    rules[n]   = RULE_BIN_NUM_LHS;
+    costs[n++] = y + rule_cost(node, RULE_BIN_NUM_LHS);
+  } else if (is_var(rhs)) {
+    rules[n]   = RULE_BIN_VAR;
+    costs[n++] = x + rule_cost(node, RULE_BIN_VAR);
+  } else if (is_var(lhs) && !ordered(fx, fy)) {
+    rules[n]   = RULE_BIN_VAR_LHS;
+    costs[n++] = y + rule_cost(node, RULE_BIN_VAR_LHS);
+  }
+
+  for (int i = 0; i < n; i++) {
+    if (costs[i] < best_cost) {
+      best      = rules[i];
+      best_cost = costs[i];
+    }
+  }
+  node->rule = best;
+  return best_cost;
+}
+
+/**
+ * Get the condition code of a comparison.
+ *
+ * @param kind Node kind
+ * @param swap Are the operands swapped
+ *
+ * @return Condition code
+ */
+static char *cond(NodeKind kind, bool swap) {
+  switch (kind) {
+    case NODE_EQ:
+      return "e";
+    case NODE_NE:
+      return "ne";
+    case NODE_LT:
+      return swap ? "g" : "l";
+    default:
+      return swap ? "ge" : "le";
+  }
+}
+
+/**
+ * Combine RAX with an operand, leaving the result in RAX. Facts from the range
+ * pass select 32-bit multiplications and divisions, and comparisons of the
+ * low bytes of booleans.
+ *
+ * @param node Binary
+ * @param arg "rdi" or an immediate
+ * @param swap Are the operands swapped, for comparisons
+ * @param low_byte Is only AL used, for comparisons
+ */
+static void emit_op(Node *node, char *arg, bool swap, bool low_byte) {
+  bool reg = !strcmp(arg, "rdi");
+  switch (node->kind) {
+    case NODE_ADD:
+      emit("  add rax, %s\n", arg);
+      break;
+    case NODE_SUB:
+      emit("  sub rax, %s\n", arg);
+      break;
+    case NODE_MUL:
+      // The low 32 bits of a product in [0, UINT32_MAX] are all of it
+      if (has_fact(node, FACT_U32)) {
+        count_rewrite(REWRITE_IMUL32);
+        if (reg)
+          emit("  imul eax, edi\n");
+        else
+          emit("  imul eax, eax, %s\n", arg);
+      } else if (reg) {
+        emit("  imul rax, rdi\n");
+      } else {
+        emit("  imul rax, rax, %s\n", arg);
+      }
+      break;
+    case NODE_DIV:
+      if (is_div32(node)) {
+        count_rewrite(REWRITE_DIV32);
+        if (!reg) emit("  mov edi, %s\n", arg);
+        emit("  xor edx, edx\n");
+        emit("  div edi\n");
+      } else {
+        if (!reg) emit("  mov rdi, %s\n", arg);
+        emit("  cqo\n");
+        emit("  idiv rdi\n");
+      }
+      break;
+    default:
+      if (is_byte_cmp(node))
+        emit("  cmp al, %s\n", reg ? "dil" : arg);
+      else
+        emit("  cmp rax, %s\n", arg);
+      emit("  set%s al\n", cond(node->kind, swap));
+      if (low_byte)
+        count_rewrite(REWRITE_MOVZB);
+      else
+        emit("  movzb rax, al\n");
+      break;
+  }
+}
+
+/**
+ * Emit a lea that multiplies RAX by 2, 3, 4, 5, 8 or 9 and adds a constant.
+ *
+ * @param scale Multiplier
+ * @param disp Constant
+ */
+static void emit_lea_scale(int scale, long disp) {
+  char *base = scale % 2 ? "rax + " : "";
+  if (disp)
+    emit("  lea rax, [%srax*%d %c %ld]\n", base, scale & ~1,
+         disp < 0 ? '-' : '+', labs(disp));
+  else
+    emit("  lea rax, [%srax*%d]\n", base, scale & ~1);
+}
+
+/**
+ * Emit the code of the cover chosen by label(), leaving the value in RAX.
+ *
+ * @param node Tree
+ * @param low_byte Is only AL used, so that a comparison need not zero-extend
+ *                 its result
+ */
+static void reduce(Node *node, bool low_byte) {
+  Node *lhs = node->lhs, *rhs = node->rhs;
+  bool byte = is_byte_cmp(node);
+  char imm[16];
+  if (rhs && is_num(rhs)) snprintf(imm, sizeof(imm), "%d", rhs->val);
+
+  switch ((Rule)node->rule) {
+    case RULE_NUM:
+      emit("  mov rax, %d\n", node->val);
+      return;
+    case RULE_BIN:
+      reduce(rhs, byte);
+      push();
+      reduce(lhs, byte);
+      pop("rdi");
+      emit_op(node, "rdi", false, low_byte);
+      return;
+    case RULE_BIN_NUM_LHS:
+      reduce(rhs, byte);
+      emit("  mov rdi, rax\n");
+      emit("  mov rax, %d\n", lhs->val);
+      emit_op(node, "rdi", false, low_byte);
+      return;
+    case RULE_IMM:
+      reduce(lhs, byte);
+      emit_op(node, imm, false, low_byte);
+      return;
+    case RULE_IMM_SWAP:
+      reduce(rhs, byte);
+      snprintf(imm, sizeof(imm), "%d", lhs->val);
+      emit_op(node, imm, true, low_byte);
+      return;
+    case RULE_NEG:
+      reduce(rhs, false);
+      emit("  neg rax\n");
+      return;
+    case RULE_RSUB:
+      reduce(rhs, false);
+      emit("  neg rax\n");
+      emit("  add rax, %d\n", lhs->val);
+      return;
+    case RULE_LEA_SCALE:
+      reduce(lhs, false);
+      emit_lea_scale(rhs->val, 0);
+      return;
+    case RULE_LEA_ADD:
+      reduce(lhs->rhs, false);
+      push();
+      reduce(lhs->lhs, false);
+      pop("rdi");
+      emit("  lea rax, [rax + rdi %c %ld]\n", rhs->val < 0 ? '-' : '+',
+           labs(rhs->val));
+      return;
+    case RULE_LEA_SCALE_ADD:
+      reduce(lhs->lhs, false);
+      emit_lea_scale(lhs->rhs->val, rhs->val);
+      return;
+    case RULE_SEQ:
+      reduce(lhs, false);
+      reduce(rhs, low_byte);
+      return;
+    case RULE_VAR:
+      emit("  mov rax, %s\n", locals[node->var]->loc);
+      return;
+    case RULE_ASSIGN:
+      // The whole value is stored, even if only AL is used
+      reduce(rhs, false);
+      emit("  mov %s, rax\n", locals[lhs->var]->loc);
+      return;
+    case RULE_BIN_VAR:
+      reduce(lhs, byte);
+      emit("  mov rdi, %s\n", locals[rhs->var]->loc);
+      emit_op(node, "rdi", false, low_byte);
+      return;
+    case RULE_BIN_VAR_LHS:
+      reduce(rhs, byte);
+      emit("  mov rdi, rax\n");
+      emit("  mov rax, %s\n", locals[lhs->var]->loc);
+      emit_op(node, "rdi", false, low_byte);
+      return;
+    case RULE_BIN_IN_ORDER:
+      reduce(lhs, byte);
+      push();
+      reduce(rhs, byte);
+      emit("  mov rdi, rax\n");
+      pop("rax");
+      emit_op(node, "rdi", false, low_byte);
+      return;
+  }
+}
+
+/**
+ * Generate code for a statement of main by covering the tree with instruction
+ * patterns. Unlike gen(), values are computed in RAX and only pushed while the
+ * other operand of a binary is computed, numbers become immediates, negation,
+ * additions of constants and small multipliers use neg and lea, and local
+ * variables are used where they live. Of the covers that apply, the one with
+ * the lowest total latency on a microarchitecture is chosen. The value is left
+ * in RAX.
+ *
+ * @param node Tree
+ * @param uarch Microarchitecture whose latencies cost the covers
+ */
+void gen_isel(Node *node, Uarch *uarch) {
+  model = uarch;
+  int effects;
+  label(node, &effects);
+  reduce(node, false);
+}
@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "c_compiler.h"
+
+// Registers of the kernel. The arguments are moved out of RDI, RSI and RDX
+// because the stack machine code uses those for operands and idiv.
+#define COLS "r8"   // const int64_t **cols
+#define OUT "r9"    // int64_t *out
+#define N "r10"     // size_t n
+#define ROW "r11"   // Current row
+
+/**
+ * Generate scalar code that evaluates a node for one row, leaving the result
+ * on the stack like gen() does.
+ *
+ * @param node Parsed node
+ */
+static void gen_scalar(Node *node) {
+  if (node->kind == NODE_NUM) {
+    emit("  push %d\n", node->val);
+    return;
+  }
+
+  if (node->kind == NODE_COL) {
+    emit("  mov rax, [" COLS " + %d]\n", node->col * 8);
+    emit("  push qword ptr [rax + " ROW " * 8]\n");
+    return;
+  }
+
+  gen_scalar(node->lhs);
+  gen_scalar(node->rhs);
+
+  pop("rdi");
+  pop("rax");
+  gen_binary(node->kind);
+  push();
+}
+
+// Intermediate values at depth d of the evaluation live in YMMd while d is
+// below this limit. Deeper values are spilled to the stack. YMM12 to YMM15 are
+// scratch registers.
+#define VECTOR_REGS 12
+
+/**
+ * Generate an AVX2 binary operation on four lanes: dst = a op b.
+ *
+ * @param node Binary
+ * @param dst Destination register number, which may be a or b
+ * @param a Left-hand side register number
+ * @param b Right-hand side register number
+ */
+static void gen_vector_binary(Node *node, int dst, int a, int b) {
+  // Operands in [0, UINT32_MAX] are their low 32 bits
+  bool narrow =
+      has_fact(node->lhs, FACT_U32) && has_fact(node->rhs, FACT_U32);
+
+  switch (node->kind) {
+    case NODE_ADD:
+      emit("  vpaddq ymm%d, ymm%d, ymm%d\n", dst, a, b);
+      break;
+    case NODE_SUB:
+      emit("  vpsubq ymm%d, ymm%d, ymm%d\n", dst, a, b);
+      break;
+    case NODE_MUL:
+      if (narrow) {
+        count_rewrite(REWRITE_IMUL32);
+        emit("  vpmuludq ymm%d, ymm%d, ymm%d\n", dst, a, b);
+        break;
+      }
+
+      // AVX2 has no 64-bit multiply, so build the low 64 bits of the product
+      // from 32x32-bit ones: lo*lo + ((hi*lo + lo*hi) << 32)
+      emit("  vpsrlq ymm12, ymm%d, 32\n", a);
+      emit("  vpmuludq ymm12, ymm12, ymm%d\n", b);
+      emit("  vpsrlq ymm13, ymm%d, 32\n", b);
+      emit("  vpmuludq ymm13, ymm13, ymm%d\n", a);
+      emit("  vpaddq ymm12, ymm12, ymm13\n");
+      emit("  vpsllq ymm12, ymm12, 32\n");
+      emit("  vpmuludq ymm%d, ymm%d, ymm%d\n", dst, a, b);
+      emit("  vpaddq ymm%d, ymm%d, ymm12\n", dst, dst);
+      break;
+    case NODE_DIV:
+      // There is no vector division, so divide lane by lane with idiv
+      emit("  sub rsp, 64\n");
+      emit("  vmovdqu [rsp], ymm%d\n", a);
+      emit("  vmovdqu [rsp + 32], ymm%d\n", b);
+      if (narrow) count_rewrite(REWRITE_DIV32);
+      for (int i = 0; i < 4; i++) {
+        if (narrow) {
+          emit("  mov eax, [rsp + %d]\n", i * 8);
+          emit("  xor edx, edx\n");
+          emit("  div dword ptr [rsp + %d]\n", 32 + i * 8);
+        } else {
+          emit("  mov rax, [rsp + %d]\n", i * 8);
+          emit("  cqo\n");
+          emit("  idiv qword ptr [rsp + %d]\n", 32 + i * 8);
+        }
+        emit("  mov [rsp + %d], rax\n", i * 8);
+      }
+      emit("  vmovdqu ymm%d, [rsp]\n", dst);
+      emit("  add rsp, 64\n");
+      break;
+    case NODE_EQ:
+      // Comparisons yield all-ones masks, shifted down to 0 or 1
+      emit("  vpcmpeqq ymm%d, ymm%d, ymm%d\n", dst, a, b);
+      emit("  vpsrlq ymm%d, ymm%d, 63\n", dst, dst);
+      break;
+    case NODE_NE:
+      emit("  vpcmpeqq ymm%d, ymm%d, ymm%d\n", dst, a, b);
+      emit("  vpcmpeqq ymm15, ymm15, ymm15\n");
+      emit("  vpxor ymm%d, ymm%d, ymm15\n", dst, dst);
+      emit("  vpsrlq ymm%d, ymm%d, 63\n", dst, dst);
+      break;
+    case NODE_LT:
+      emit("  vpcmpgtq ymm%d, ymm%d, ymm%d\n", dst, b, a);
+      emit("  vpsrlq ymm%d, ymm%d, 63\n", dst, dst);
+      break;
+    case NODE_LE:
+      emit("  vpcmpgtq ymm%d, ymm%d, ymm%d\n", dst, a, b);
+      emit("  vpcmpeqq ymm15, ymm15, ymm15\n");
+      emit("  vpxor ymm%d, ymm%d, ymm15\n", dst, dst);
+      emit("  vpsrlq ymm%d, ymm%d, 63\n", dst, dst);
+      break;
+    case NODE_SEQ:
+      if (dst != b) emit("  vmovdqa ymm%d, ymm%d\n", dst, b);
+      break;
+  }
+}
+
+/**
+ * Generate AVX2 code that evaluates a node for four rows at once.
+ *
+ * @param node Parsed node
+ * @param depth Evaluation depth; the result is left in YMM<depth>, or in
+ *              YMM<VECTOR_REGS - 1> if depth is beyond the register limit
+ */
+static void gen_vector(Node *node, int depth) {
+  int dst = depth < VECTOR_REGS ? depth : VECTOR_REGS - 1;
+
+  if (node->kind == NODE_NUM) {
+    emit("  mov rax, %d\n", node->val);
+    emit("  vmovq xmm%d, rax\n", dst);
+    emit("  vpbroadcastq ymm%d, xmm%d\n", dst, dst);
+    return;
+  }
+
+  if (node->kind == NODE_COL) {
+    emit("  mov rax, [" COLS " + %d]\n", node->col * 8);
+    emit("  vmovdqu ymm%d, [rax + " ROW " * 8]\n", dst);
+    return;
+  }
+
+  gen_vector(node->lhs, depth);
+
+  if (depth + 1 < VECTOR_REGS) {
+    gen_vector(node->rhs, depth + 1);
+    gen_vector_binary(node, dst, dst, dst + 1);
+    return;
+  }
+
+  // Out of registers: keep the left-hand side on the stack meanwhile
+  emit("  sub rsp, 32\n");
+  emit("  vmovdqu [rsp], ymm%d\n", dst);
+  gen_vector(node->rhs, depth + 1);
+  emit("  vmovdqu ymm14, [rsp]\n");
+  emit("  add rsp, 32\n");
+  gen_vector_binary(node, dst, 14, dst);
+}
+
+/**
+ * Generate a kernel with the C signature
+ *
+ *   void name(const int64_t **cols, int64_t *out, size_t n);
+ *
+ * that stores the value of the expression for each row i in out[i], reading
+ * input column c from cols[c][i].
+ *
+ * @param node Parsed node
+ * @param name Function name
+ * @param avx2 Evaluate four rows at a time with AVX2
+ */
+void gen_kernel(Node *node, char *name, bool avx2) {
+  emit(".intel_syntax noprefix\n");
+  for (int i = 0; columns && i <= columns->index; i++)
+    for (Column *col = columns; col; col = col->next)
+      if (col->index == i)
+        emit("# cols[%d] = %.*s\n", col->index, (int)col->len, col->name);
+  emit(".text\n");
+  emit(".global %s\n", name);
+  emit("%s:\n", name);
+  emit("  mov " COLS ", rdi\n");
+  emit("  mov " OUT ", rsi\n");
+  emit("  mov " N ", rdx\n");
+  emit("  xor " ROW ", " ROW "\n");
+
+  if (avx2) {
+    emit(".L%s_vector:\n", name);
+    emit("  lea rax, [" ROW " + 4]\n");
+    emit("  cmp rax, " N "\n");
+    emit("  ja .L%s_scalar\n", name);
+    gen_vector(node, 0);
+    emit("  vmovdqu [" OUT " + " ROW " * 8], ymm0\n");
+    emit("  add " ROW ", 4\n");
+    emit("  jmp .L%s_vector\n", name);
+  }
+
+  // Remaining rows, or all of them without AVX2
+  emit(".L%s_scalar:\n", name);
+  emit("  cmp " ROW ", " N "\n");
+  emit("  jae .L%s_done\n", name);
+  gen_scalar(node);
+  pop("rax");
+  emit("  mov [" OUT " + " ROW " * 8], rax\n");
+  emit("  inc " ROW "\n");
+  emit("  jmp .L%s_scalar\n", name);
+
+  emit(".L%s_done:\n", name);
+  if (avx2) emit("  vzeroupper\n");
+  ret();
+  emit(".section .note.GNU-stack,\"\",@progbits\n");
+}
@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "c_compiler.h"
+
+// Callee-saved registers that local variables are promoted to, in order
+static char *callee_saved[] = {"rbx", "r12", "r13", "r14", "r15"};
+
+#define NUM_CALLEE_SAVED (sizeof(callee_saved) / sizeof(*callee_saved))
+
+// Fewest uses that make a variable worth a register: the register costs a
+// push in the prologue and a pop in the epilogue, and each use of a frame slot
+// costs one memory access
+#define PROMOTE_MIN_USES 3
+
+Var **locals;
+int nlocals;
+static int cap_locals;
+
+// Local variables by name, in chained buckets
+static Var **buckets;
+static int nbuckets;
+
+// Frame of main, laid out by layout_frame()
+static bool has_frame;
+static int nsaved;      // Callee-saved registers pushed by the prologue
+static int frame_size;  // Bytes of frame slots below them
+
+/**
+ * Hash a variable name.
+ *
+ * @param name Name
+ * @param len Name length
+ *
+ * @return Hash
+ */
+static uint32_t hash_name(char *name, size_t len) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++)
+    h = (h ^ (unsigned char)name[i]) * 16777619u;
+  return h;
+}
+
+/**
+ * Double the number of buckets and rehash the variables into them, so that a
+ * bucket holds one variable on average.
+ */
+static void grow_buckets(void) {
+  int cap = nbuckets ? nbuckets * 2 : 16;
+  mem_free(MEM_LOCAL, buckets, nbuckets * sizeof(Var *));
+  buckets  = mem_alloc(MEM_LOCAL, cap * sizeof(Var *));
+  nbuckets = cap;
+  memset(buckets, 0, cap * sizeof(Var *));
+
+  for (int i = 0; i < nlocals; i++) {
+    Var *var     = locals[i];
+    Var **bucket = &buckets[hash_name(var->name, var->len) % cap];
+    var->next    = *bucket;
+    *bucket      = var;
+  }
+}
+
+/**
+ * Find the local variable named by an identifier.
+ *
+ * @param tok Identifier token
+ *
+ * @return Variable, or NULL if none has been assigned yet
+ */
+Var *find_local(Token *tok) {
+  if (!nlocals) return NULL;
+  uint32_t h = hash_name(tok->str, tok->len);
+  for (Var *var = buckets[h % nbuckets]; var; var = var->next)
+    if (var->len == tok->len && !memcmp(var->name, tok->str, tok->len))
+      return var;
+  return NULL;
+}
+
+/**
+ * Find the local variable named by an identifier, declaring it on its first
+ * assignment.
+ *
+ * @param tok Identifier token
+ *
+ * @return Variable
+ */
+Var *declare_local(Token *tok) {
+  Var *var = find_local(tok);
+  if (var) return var;
+
+  if (nlocals == cap_locals) {
+    int cap    = cap_locals ? cap_locals * 2 : 16;
+    locals     = mem_realloc(MEM_LOCAL, locals, cap_locals * sizeof(Var *),
+                             cap * sizeof(Var *));
+    cap_locals = cap;
+  }
+  if (nlocals == nbuckets) grow_buckets();
+
+  var               = mem_alloc(MEM_LOCAL, sizeof(Var));
+  Var **bucket      = &buckets[hash_name(tok->str, tok->len) % nbuckets];
+  var->next         = *bucket;
+  var->name         = tok->str;
+  var->len          = tok->len;
+  var->index        = nlocals;
+  var->pos          = tok->pos;
+  *bucket           = var;
+  locals[nlocals++] = var;
+  return var;
+}
+
+/**
+ * Count the reads and writes of each local variable in a tree.
+ *
+ * @param node Tree
+ */
+static void count_uses(Node *node) {
+  if (node->kind == NODE_VAR) {
+    locals[node->var]->uses++;
+    return;
+  }
+  if (!node->lhs) return;
+  count_uses(node->lhs);
+  count_uses(node->rhs);
+}
+
+/**
+ * Order variables by uses, the most used first, and then by index.
+ *
+ * @param a Variable
+ * @param b Variable
+ *
+ * @return Comparison result
+ */
+static int by_uses(const void *a, const void *b) {
+  Var *x = *(Var **)a, *y = *(Var **)b;
+  if (x->uses != y->uses) return y->uses - x->uses;
+  return x->index - y->index;
+}
+
+/**
+ * Lay out the frame of main for the local variables of a tree, once the AST
+ * passes have run. The variables used most, up to one per callee-saved
+ * register, live in those registers, which the prologue saves; the others
+ * live in frame slots below the saved registers, addressed from RBP. With
+ * --frame-slots, every variable lives in a frame slot.
+ *
+ * @param node Tree
+ */
+void layout_frame(Node *node) {
+  if (!nlocals) return;
+  count_uses(node);
+
+  Var **order = mem_alloc(MEM_LOCAL, nlocals * sizeof(Var *));
+  memcpy(order, locals, nlocals * sizeof(Var *));
+  qsort(order, nlocals, sizeof(Var *), by_uses);
+  for (int i = 0; i < nlocals && i < NUM_CALLEE_SAVED; i++) {
+    if (pass_options.frame_slots || order[i]->uses < PROMOTE_MIN_USES) break;
+    strcpy(order[i]->loc, callee_saved[i]);
+    order[i]->in_reg = true;
+    nsaved++;
+  }
+  mem_free(MEM_LOCAL, order, nlocals * sizeof(Var *));
+
+  int nslots = 0;
+  for (int i = 0; i < nlocals; i++)
+    if (!locals[i]->loc[0])
+      snprintf(locals[i]->loc, sizeof(locals[i]->loc), "qword ptr [rbp - %d]",
+               (nsaved + ++nslots) * 8);
+
+  // RSP stays 16-byte aligned below the saved RBP
+  has_frame  = true;
+  frame_size = (nslots + (nsaved + nslots) % 2) * 8;
+}
+
+/**
+ * Generate the prologue of main if it has a frame: set up RBP, save the
+ * callee-saved registers that variables live in, and make room for the frame
+ * slots.
+ */
+void gen_prologue(void) {
+  if (!has_frame) return;
+  emit("  push rbp\n");
+  emit("  mov rbp, rsp\n");
+  for (int i = 0; i < nsaved; i++) emit("  push %s\n", callee_saved[i]);
+  if (frame_size) emit("  sub rsp, %d\n", frame_size);
+
+  // The scheduler leaves a block that moves RSP as it is, so the body starts
+  // a block of its own
+  emit(".Lbody:\n");
+}
+
+/**
+ * Generate the epilogue of main if it has a frame, restoring the registers
+ * that the prologue saved. The value of main stays in RAX.
+ */
+void gen_epilogue(void) {
+  if (!has_frame) return;
+  emit(".Lreturn:\n");
+  if (nsaved)
+    emit("  lea rsp, [rbp - %d]\n", nsaved * 8);
+  else
+    emit("  mov rsp, rbp\n");
+  for (int i = nsaved - 1; i >= 0; i--) pop(callee_saved[i]);
+  pop("rbp");
+}
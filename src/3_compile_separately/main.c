@@ -1,25 +1,618 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "c_compiler.h"
 
-char *user_input;
-Token *token;
+// Options that affect the generated code, part of the cache key
+static char flags[4096];
 
-int main(int argc, char **argv) {
-  if (argc != 2) {
-    error("%s: Not correct number of arguments", argv[0]);
+// Print cache statistics after compiling
+static bool print_cache_stats;
+
+// How to evaluate the program instead of generating code
+static enum {
+  INTERP_NONE,      // Generate assembly
+  INTERP_BYTECODE,  // Run on the bytecode interpreter
+  INTERP_TREE,      // Walk the node tree
+} interp;
+
+// Name of the kernel to generate, or NULL to generate main
+static char *kernel_name;
+
+// Generate the kernel with AVX2
+static bool kernel_avx2 = true;
+
+// Microarchitecture to schedule instructions for, or NULL not to schedule
+static Uarch *sched_uarch;
+
+// Print memory use by category and phase
+static bool mem_report;
+
+// Microarchitecture to estimate the cost of the code for, or NULL not to
+static Uarch *cost_uarch;
+
+// Lex, parse and generate code on concurrent threads
+static bool pipeline;
+
+// Compile one statement at a time, freeing its nodes once its code is written
+static bool per_statement;
+
+// Generate code while parsing, without a token list or a tree
+static bool one_pass;
+
+// Threads to generate code on
+static int jobs = 1;
+
+// Generate code by instruction selection rather than as a stack machine
+static bool isel;
+
+// Optimization level
+static int opt_level;
+
+// Comma-separated passes that replace those of the optimization level
+static char *fpass;
+
+// Print the time each pass takes
+static bool time_passes;
+
+// Print the number of sites each value range rewrite applied to
+static bool rewrite_stats;
+
+// File the input is read from, or NULL if it is an argument
+static char *input_path;
+
+// Size of the window to stream the input file through, or 0 to read it whole
+static size_t stream_window;
+
+// Binary AST file to compile instead of a source, or NULL
+static char *ast_path;
+
+// Write the binary AST instead of assembly
+static bool emit_ast;
+
+// File to assemble the code into, or NULL to write the assembly to stdout
+static char *out_path;
+
+// Stop at an object file rather than link an executable
+static bool compile_only;
+
+/**
+ * Read a whole file into a NUL-terminated string.
+ *
+ * @param path File path, or "-" for stdin
+ *
+ * @return File contents
+ */
+static char *read_file(char *path) {
+  FILE *fp = strcmp(path, "-") ? fopen(path, "r") : stdin;
+  if (!fp) error("cannot open %s: %s", path, strerror(errno));
+
+  size_t cap = 4096, len = 0;
+  char *buf  = mem_alloc(MEM_INPUT, cap);
+  while (true) {
+    if (len + 1 == cap) {
+      buf = mem_realloc(MEM_INPUT, buf, cap, cap * 2);
+      cap *= 2;
+    }
+    size_t n = fread(buf + len, 1, cap - len - 1, fp);
+    if (n == 0) break;
+    len += n;
   }
 
-  user_input = argv[1];
-  token      = tokenize();
-  Node *node = expr();
+  if (ferror(fp)) error("cannot read %s: %s", path, strerror(errno));
+  if (fp != stdin) fclose(fp);
+  buf[len] = '\0';
+  return buf;
+}
 
-  // Generate code
-  gen_header();
-  gen(node);
+/**
+ * Parse command line arguments.
+ *
+ * @param argc Number of arguments
+ * @param argv Arguments
+ */
+static void parse_args(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    if (!strncmp(argv[i], "--cache-dir=", 12)) {
+      cache_dir = argv[i] + 12;
+      continue;
+    }
+
+    if (!strncmp(argv[i], "--cache-size=", 13)) {
+      cache_limit = strtoull(argv[i] + 13, NULL, 10);
+      if (cache_limit == 0) error("%s: invalid value: %s", argv[0], argv[i]);
+      continue;
+    }
+
+    if (!strcmp(argv[i], "--cache-stats")) {
+      print_cache_stats = true;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "--interp")) {
+      interp = INTERP_BYTECODE;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "--interp=tree")) {
+      interp = INTERP_TREE;
+      continue;
+    }
+
+    if (!strncmp(argv[i], "--kernel=", 9)) {
+      kernel_name = argv[i] + 9;
+      continue;
+    }
+
+    if (!strncmp(argv[i], "--kernel-isa=", 13)) {
+      if (!strcmp(argv[i] + 13, "avx2"))
+        kernel_avx2 = true;
+      else if (!strcmp(argv[i] + 13, "scalar"))
+        kernel_avx2 = false;
+      else
+        error("%s: invalid value: %s", argv[0], argv[i]);
+      continue;
+    }
+
+    if (!strcmp(argv[i], "--sched")) {
+      sched_uarch = find_uarch("generic");
+      continue;
+    }
+
+    if (!strncmp(argv[i], "--sched=", 8)) {
+      sched_uarch = find_uarch(argv[i] + 8);
+      if (!sched_uarch) error("%s: invalid value: %s", argv[0], argv[i]);
+      continue;
+    }
+
+    if (!strcmp(argv[i], "--pipeline")) {
+      pipeline = true;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "--per-statement")) {
+      per_statement = true;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "--one-pass")) {
+      one_pass = true;
+      continue;
+    }
+
+    if (!strncmp(argv[i], "-O", 2)) {
+      // -O alone is -O1
+      char *end = "";
+      opt_level = argv[i][2] ? strtol(argv[i] + 2, &end, 10) : 1;
+      if (*end || !select_opt_level(opt_level))
+        error("%s: invalid value: %s", argv[0], argv[i]);
+      continue;
+    }
+
+    if (!strncmp(argv[i], "-fpass=", 7)) {
+      fpass = argv[i] + 7;
+      if (!select_passes(fpass))
+        error("%s: invalid pass list: %s", argv[0], argv[i]);
+      continue;
+    }
+
+    if (!strcmp(argv[i], "--time-passes")) {
+      time_passes = true;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "--rewrite-stats")) {
+      rewrite_stats = true;
+      continue;
+    }
+
+    if (!strncmp(argv[i], "--dump-after=", 13)) {
+      pass_options.dump_after = argv[i] + 13;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "--isel")) {
+      isel = true;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "--frame-slots")) {
+      pass_options.frame_slots = true;
+      continue;
+    }
+
+    if (!strncmp(argv[i], "--jobs=", 7)) {
+      char *end;
+      jobs = strtol(argv[i] + 7, &end, 10);
+      if (*end || jobs < 0) error("%s: invalid value: %s", argv[0], argv[i]);
+      if (jobs == 0) jobs = sysconf(_SC_NPROCESSORS_ONLN);
+      continue;
+    }
+
+    if (!strcmp(argv[i], "--cost-report")) {
+      cost_uarch = find_uarch("generic");
+      continue;
+    }
+
+    if (!strncmp(argv[i], "--cost-report=", 14)) {
+      cost_uarch = find_uarch(argv[i] + 14);
+      if (!cost_uarch) error("%s: invalid value: %s", argv[0], argv[i]);
+      continue;
+    }
+
+    if (!strcmp(argv[i], "--mem-report")) {
+      mem_report = true;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "--version")) {
+      printf("c_compiler %s\n", VERSION);
+      exit(0);
+    }
+
+    if (!strncmp(argv[i], "--max-errors=", 13)) {
+      max_errors = atoi(argv[i] + 13);
+      if (max_errors <= 0) error("%s: invalid value: %s", argv[0], argv[i]);
+      continue;
+    }
+
+    if (!strcmp(argv[i], "--stream")) {
+      stream_window = 1 << 20;
+      continue;
+    }
+
+    if (!strncmp(argv[i], "--stream=", 9)) {
+      char *end;
+      stream_window = strtoull(argv[i] + 9, &end, 10);
+      if (*end || stream_window == 0)
+        error("%s: invalid value: %s", argv[0], argv[i]);
+      continue;
+    }
+
+    if (!strncmp(argv[i], "--emit-ast=", 11)) {
+      if (strcmp(argv[i] + 11, "bin"))
+        error("%s: invalid value: %s", argv[0], argv[i]);
+      emit_ast = true;
+      continue;
+    }
+
+    if (!strncmp(argv[i], "--from-ast=", 11)) {
+      if (user_input || input_path || ast_path)
+        error("%s: Not correct number of arguments", argv[0]);
+      ast_path = argv[i] + 11;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-o")) {
+      if (++i == argc) error("%s: -o needs a file", argv[0]);
+      out_path = argv[i];
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-c")) {
+      compile_only = true;
+      continue;
+    }
+
+    if (!strncmp(argv[i], "--file=", 7)) {
+      if (user_input || input_path || ast_path)
+        error("%s: Not correct number of arguments", argv[0]);
+      input_path = argv[i] + 7;
+      continue;
+    }
 
+    if (user_input || input_path || ast_path)
+      error("%s: Not correct number of arguments", argv[0]);
+    user_input = argv[i];
+  }
+
+  // Every option that is not about caching, reporting, threads, the input or
+  // the output is part of the key
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-o")) {
+      i++;
+      continue;
+    }
+    if (argv[i] == user_input || !strcmp(argv[i], "-c") ||
+        !strncmp(argv[i], "--cache-", 8) || !strncmp(argv[i], "--file=", 7) ||
+        !strcmp(argv[i], "--mem-report") ||
+        !strncmp(argv[i], "--cost-report", 13) ||
+        !strncmp(argv[i], "--jobs=", 7) || !strcmp(argv[i], "--time-passes") ||
+        !strcmp(argv[i], "--rewrite-stats") ||
+        !strncmp(argv[i], "--dump-after=", 13) ||
+        !strncmp(argv[i], "--stream", 8))
+      continue;
+    if (strlen(flags) + strlen(argv[i]) + 2 > sizeof(flags))
+      error("%s: too many options", argv[0]);
+    strcat(flags, argv[i]);
+    strcat(flags, " ");
+  }
+
+  if (!user_input && !input_path && !ast_path)
+    error("%s: Not correct number of arguments", argv[0]);
+  if (ast_path && (pipeline || per_statement || cache_dir))
+    error("%s: --from-ast cannot be pipelined, compiled per statement or "
+          "cached", argv[0]);
+  if (emit_ast && (pipeline || per_statement || kernel_name ||
+                   interp != INTERP_NONE || cache_dir || cost_uarch))
+    error("%s: --emit-ast only writes the tree of the program", argv[0]);
+  if (stream_window && (!input_path || !strcmp(input_path, "-")))
+    error("%s: --stream needs --file= with a file to read", argv[0]);
+  if (stream_window && cache_dir)
+    error("%s: --stream cannot be cached", argv[0]);
+  if (compile_only && !out_path) error("%s: -c needs -o", argv[0]);
+  if (out_path && (interp != INTERP_NONE || emit_ast))
+    error("%s: -o only assembles generated code", argv[0]);
+  if (out_path && kernel_name && !compile_only)
+    error("%s: a kernel can only be assembled with -c", argv[0]);
+
+  if (stream_window)
+    stream_input(input_path, stream_window);
+  else if (input_path)
+    user_input = read_file(input_path);
+  if (pipeline && (kernel_name || interp != INTERP_NONE))
+    error("%s: --pipeline only generates main", argv[0]);
+  if (cost_uarch && (kernel_name || interp != INTERP_NONE))
+    error("%s: --cost-report only models main", argv[0]);
+
+  // -fpass= overrides the optimization level; --isel and --sched add to
+  // either
+  if (fpass)
+    select_passes(fpass);
+  else
+    select_opt_level(opt_level);
+  if (isel) use_pass("isel");
+  if (sched_uarch) use_pass("sched");
+  pass_options.uarch = sched_uarch ? sched_uarch : find_uarch("generic");
+  pass_options.jobs  = jobs;
+
+  if (has_pass("isel") && jobs > 1)
+    error("%s: --jobs needs the stack machine code generator", argv[0]);
+  if (pipeline && (!has_pass("gen") || has_ast_passes() || jobs > 1))
+    error("%s: --pipeline needs the stack machine code generator and no "
+          "AST passes", argv[0]);
+  if (per_statement && (pipeline || kernel_name || interp != INTERP_NONE ||
+                        cache_dir || cost_uarch || has_asm_passes()))
+    error("%s: --per-statement only generates main, without assembly "
+          "passes or caching", argv[0]);
+  if (one_pass && (pipeline || per_statement || kernel_name ||
+                   interp != INTERP_NONE || emit_ast || ast_path ||
+                   stream_window || !has_pass("gen") || has_ast_passes() ||
+                   jobs > 1 || pass_options.dump_after))
+    error("%s: --one-pass only generates main, as a stack machine from an "
+          "input in memory", argv[0]);
+}
+
+/**
+ * Report the first local variable of a program compiled in a mode that does
+ * not lay out a frame for them.
+ *
+ * @param mode Option of the mode
+ */
+static void reject_locals(char *mode) {
+  if (nlocals > 0)
+    error_at(locals[0]->pos, "local variables are not supported with %s",
+             mode);
+}
+
+/**
+ * Compile the input while parsing it and write the assembly to output. No
+ * token list or tree is built, so memory does not grow with the input beyond
+ * the input itself.
+ *
+ * @return Exit status
+ */
+static int compile_one_pass(void) {
+  double start = pass_clock();
+  token        = tokenize_on_demand();
+  gen_header();
+  gen_one_pass();
   pop("rax");
   ret();
+  pass_timed("one-pass", start);
+  mem_phase("codegen");
+
+  if (error_count > 0) {
+    print_diagnostics();
+    return 1;
+  }
+  if (columns) {
+    Column *first = columns;
+    while (first->next) first = first->next;
+    error_at(first->pos, "input columns are only supported with --kernel");
+  }
+  return 0;
+}
+
+/**
+ * Compile the input one statement at a time and write the assembly to output.
+ * The tokens are lexed a chunk at a time into two buffers that are reused, and
+ * the nodes of a statement are allocated from an arena that is reset once its
+ * code is written, so memory does not grow with the number of statements.
+ *
+ * @return Exit status
+ */
+static int compile_per_statement(void) {
+  Arena arena = {.cat = MEM_NODE};
+  node_arena  = &arena;
+  token       = tokenize_chunks();
+  gen_header();
+
+  for (Node *node; (node = statement());) {
+    if (error_count == 0 && !columns && nlocals == 0) {
+      dump_tree_after("parse", node);
+      run_codegen_statement(run_ast_passes(node));
+    }
+    arena_reset(&arena);
+  }
+  ret();
+  mem_phase("codegen");
+
+  if (error_count > 0) {
+    print_diagnostics();
+    return 1;
+  }
+  if (columns) {
+    Column *first = columns;
+    while (first->next) first = first->next;
+    error_at(first->pos, "input columns are only supported with --kernel");
+  }
+  reject_locals("--per-statement");
   return 0;
 }
+
+/**
+ * Compile the input and write the assembly to output.
+ *
+ * @return Exit status
+ */
+static int compile(void) {
+  if (per_statement) return compile_per_statement();
+  if (one_pass) return compile_one_pass();
+
+  Node *node;
+  if (ast_path) {
+    double start = pass_clock();
+    Ast *ast     = map_ast(ast_path);
+    pass_timed("map-ast", start);
+    mem_phase("map");
+
+    // Stack machine code needs no tree: it is the nodes in post-order
+    if (!emit_ast && !kernel_name && interp == INTERP_NONE && !columns &&
+        has_pass("gen") && !has_ast_passes() && jobs == 1 &&
+        !pass_options.dump_after) {
+      start = pass_clock();
+      gen_header();
+      gen_ast(ast);
+      pop("rax");
+      ret();
+      pass_timed("gen", start);
+      mem_phase("codegen");
+      return 0;
+    }
+
+    start = pass_clock();
+    node  = ast_tree(ast);
+    pass_timed("ast-tree", start);
+    mem_phase("ast-tree");
+  } else if (pipeline) {
+    // The nodes are freed as code is generated for them
+    pipeline_start();
+    node = program();
+    pipeline_finish();
+    mem_phase("pipeline");
+  } else {
+    double start = pass_clock();
+    token        = tokenize();
+    pass_timed("tokenize", start);
+    mem_phase("tokenize");
+
+    start = pass_clock();
+    node  = program();
+    pass_timed("parse", start);
+    mem_phase("parse");
+  }
+
+  // Report every collected error at once
+  if (error_count > 0) {
+    print_diagnostics();
+    return 1;
+  }
+
+  if (!pipeline) {
+    dump_tree_after("parse", node);
+    node = run_ast_passes(node);
+  }
+
+  if (emit_ast) {
+    reject_locals("--emit-ast");
+    write_ast(stdout, node);
+    return 0;
+  }
+
+  if (kernel_name) {
+    reject_locals("--kernel");
+    gen_kernel(node, kernel_name, kernel_avx2);
+    mem_phase("codegen");
+    return 0;
+  }
+
+  // Input columns only exist in kernels
+  if (columns) {
+    Column *first = columns;
+    while (first->next) first = first->next;
+    if (ast_path) error("input columns are only supported with --kernel");
+    error_at(first->pos, "input columns are only supported with --kernel");
+  }
+
+  // The pipeline has generated the code already
+  if (pipeline) {
+    reject_locals("--pipeline");
+    mem_phase("codegen");
+    return 0;
+  }
+
+  // Evaluate without generating code
+  if (interp != INTERP_NONE) {
+    reject_locals(interp == INTERP_TREE ? "--interp=tree" : "--interp");
+    int64_t val;
+    bool ok = interp == INTERP_TREE ? eval_tree(node, &val)
+                                    : run_bytecode(compile_bytecode(node), &val);
+    mem_phase("evaluate");
+    if (mem_report) mem_print_report();
+    return exit_with_value(ok, val);
+  }
+
+  run_codegen(node);
+  mem_phase("codegen");
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  parse_args(argc, argv);
+  mem_phase("read");
+
+  // Assemble and link through a pipe, or write the assembly
+  FILE *out = out_path ? driver_start(out_path, !compile_only) : stdout;
+
+  int status = 0;
+  if (interp != INTERP_NONE || (!cache_dir && !has_asm_passes() &&
+                                 !pass_options.dump_after && !cost_uarch)) {
+    output = out;
+    status = compile();
+  } else if (!cache_dir || cost_uarch || !cache_load(flags, out)) {
+    // Compile into memory so that the result can be rewritten, printed and
+    // stored
+    char *buf;
+    size_t len;
+    output = open_memstream(&buf, &len);
+    status = compile();
+    fclose(output);
+    mem_count(MEM_OUTPUT, len);
+
+    if (status == 0) {
+      buf = run_asm_passes(buf, &len);
+      if (has_asm_passes()) mem_phase("schedule");
+    }
+    fwrite(buf, 1, len, out);
+    PROBE(flush, len);
+    if (status == 0 && cache_dir) cache_store(buf, len);
+    if (status == 0 && cost_uarch) cost_report(buf, cost_uarch);
+    mem_free(MEM_OUTPUT, buf, len);
+  }
+
+  if (out_path) status = driver_finish(status);
+
+  if (print_cache_stats) cache_print_stats();
+  if (time_passes) print_pass_times();
+  if (rewrite_stats) print_rewrite_stats();
+
+  // The interpreters report from compile(), before a division can trap
+  if (mem_report && interp == INTERP_NONE) mem_print_report();
+  return status;
+}
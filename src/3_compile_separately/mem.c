@@ -0,0 +1,262 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "c_compiler.h"
+
+// Allocation counters of a category
+typedef struct {
+  size_t objects;  // Number of allocations
+  size_t bytes;    // Bytes allocated in total, including growth
+  size_t live;     // Bytes allocated and not yet freed
+} MemCounter;
+
+// Memory use at the end of a phase
+typedef struct {
+  char *name;   // Phase name
+  size_t peak;  // Highest live bytes during the phase
+  size_t live;  // Live bytes at the end of the phase
+  size_t rss;   // Resident set size at the end of the phase
+} MemPhase;
+
+static char *category_names[] = {
+    [MEM_INPUT] = "input",       [MEM_TOKEN] = "token",
+    [MEM_NODE] = "node",         [MEM_COLUMN] = "column",
+    [MEM_LOCAL] = "local",       [MEM_DIAG] = "diagnostic",
+    [MEM_BYTECODE] = "bytecode", [MEM_SCHED] = "sched",
+    [MEM_CODEGEN] = "codegen",   [MEM_OUTPUT] = "output",
+};
+
+static MemCounter counters[NUM_MEM_CATEGORIES];
+static MemPhase phases[16];
+static int nphases;
+
+// Live bytes over all categories, and their high-water mark in this phase
+static size_t live;
+static size_t phase_peak;
+
+// Counters of a worker thread, merged into the global ones when it is done, or
+// NULL on the main thread
+static _Thread_local MemCounter *thread_counters;
+
+/**
+ * Add to the counters of the calling thread.
+ *
+ * @param cat Category
+ * @param objects Number of allocations
+ * @param size Bytes allocated, or freed if negative
+ */
+static void count(MemCategory cat, size_t objects, ptrdiff_t size) {
+  MemCounter *c = thread_counters ? &thread_counters[cat] : &counters[cat];
+  c->objects += objects;
+  if (size > 0) c->bytes += size;
+  c->live += size;
+  if (thread_counters) return;
+
+  live += size;
+  if (live > phase_peak) phase_peak = live;
+}
+
+/**
+ * Count an allocation.
+ *
+ * @param cat Category
+ * @param size Bytes allocated
+ */
+void mem_count(MemCategory cat, size_t size) {
+  count(cat, 1, size);
+}
+
+/**
+ * Allocate zeroed memory and count it.
+ *
+ * @param cat Category
+ * @param size Bytes to allocate
+ *
+ * @return Allocated memory
+ */
+void *mem_alloc(MemCategory cat, size_t size) {
+  void *p = calloc(1, size);
+  if (!p && size) error("out of memory");
+  mem_count(cat, size);
+  return p;
+}
+
+/**
+ * Resize memory from mem_alloc(), counting the growth as allocated bytes.
+ *
+ * @param cat Category
+ * @param p Memory, or NULL to allocate it
+ * @param old_size Current size
+ * @param size New size
+ *
+ * @return Resized memory
+ */
+void *mem_realloc(MemCategory cat, void *p, size_t old_size, size_t size) {
+  if (!p) return mem_alloc(cat, size);
+
+  p = realloc(p, size);
+  if (!p && size) error("out of memory");
+  count(cat, 0, (ptrdiff_t)size - (ptrdiff_t)old_size);
+  return p;
+}
+
+/**
+ * Free memory from mem_alloc().
+ *
+ * @param cat Category
+ * @param p Memory
+ * @param size Size it was allocated with
+ */
+void mem_free(MemCategory cat, void *p, size_t size) {
+  free(p);
+  count(cat, 0, -(ptrdiff_t)size);
+}
+
+// Size of the blocks of an arena, unless an allocation needs a larger one
+#define ARENA_BLOCK 65536
+
+// Block of an arena
+struct ArenaBlock {
+  ArenaBlock *next;  // Next block
+  size_t size;       // Bytes in data
+  char data[];       // Memory handed out
+};
+
+/**
+ * Allocate zeroed memory from an arena and count it.
+ *
+ * @param arena Arena
+ * @param size Bytes to allocate
+ *
+ * @return Allocated memory, aligned like malloc()
+ */
+void *arena_alloc(Arena *arena, size_t size) {
+  size = (size + 15) & ~(size_t)15;
+
+  ArenaBlock *block = arena->blocks;
+  if (!block || arena->used + size > block->size) {
+    size_t bytes = size > ARENA_BLOCK ? size : ARENA_BLOCK;
+    block        = malloc(sizeof(ArenaBlock) + bytes);
+    if (!block) error("out of memory");
+    block->next   = arena->blocks;
+    block->size   = bytes;
+    arena->blocks = block;
+    arena->used   = 0;
+  }
+
+  void *p = block->data + arena->used;
+  arena->used += size;
+  arena->live += size;
+  mem_count(arena->cat, size);
+  return memset(p, 0, size);
+}
+
+/**
+ * Free everything allocated from an arena at once. The current block is kept
+ * for the allocations to come, so that an arena reset after each unit of work
+ * settles on one block.
+ *
+ * @param arena Arena
+ */
+void arena_reset(Arena *arena) {
+  if (!arena->blocks) return;
+  while (arena->blocks->next) {
+    ArenaBlock *next = arena->blocks->next->next;
+    free(arena->blocks->next);
+    arena->blocks->next = next;
+  }
+  count(arena->cat, 0, -(ptrdiff_t)arena->live);
+  arena->used = 0;
+  arena->live = 0;
+}
+
+/**
+ * Give the calling thread its own counters, so that it can allocate while the
+ * main thread does.
+ *
+ * @return Counters, to be passed to mem_thread_merge() once the thread is done
+ */
+void *mem_thread_begin(void) {
+  thread_counters = calloc(NUM_MEM_CATEGORIES, sizeof(MemCounter));
+  if (!thread_counters) error("out of memory");
+  return thread_counters;
+}
+
+/**
+ * Add the counters of a finished thread to the global ones. What the thread
+ * allocated counts as allocated at the time of the merge.
+ *
+ * @param thread Counters from mem_thread_begin()
+ */
+void mem_thread_merge(void *thread) {
+  MemCounter *c = thread;
+  for (int i = 0; i < NUM_MEM_CATEGORIES; i++) {
+    counters[i].objects += c[i].objects;
+    counters[i].bytes += c[i].bytes;
+    counters[i].live += c[i].live;
+    live += c[i].live;
+  }
+  if (live > phase_peak) phase_peak = live;
+  free(c);
+}
+
+/**
+ * Get the resident set size of the process.
+ *
+ * @return Bytes, or 0 if unknown
+ */
+static size_t current_rss(void) {
+  FILE *fp = fopen("/proc/self/statm", "r");
+  if (!fp) return 0;
+
+  unsigned long pages = 0;
+  if (fscanf(fp, "%*u %lu", &pages) != 1) pages = 0;
+  fclose(fp);
+  return pages * sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * End a compilation phase: record the high-water mark of live bytes during it
+ * and sample the resident set size.
+ *
+ * @param name Phase name
+ */
+void mem_phase(char *name) {
+  PROBE(phase, name, live);
+  if (nphases == sizeof(phases) / sizeof(*phases)) return;
+  phases[nphases++] = (MemPhase){name, phase_peak, live, current_rss()};
+  phase_peak        = live;
+}
+
+/**
+ * Print the allocation counters and the memory use of each phase to stderr.
+ */
+void mem_print_report(void) {
+  size_t objects = 0, bytes = 0;
+  fprintf(stderr, "%-12s %10s %12s %12s\n", "category", "objects", "bytes",
+          "live");
+  for (int i = 0; i < NUM_MEM_CATEGORIES; i++) {
+    MemCounter *c = &counters[i];
+    fprintf(stderr, "%-12s %10zu %12zu %12zu\n", category_names[i], c->objects,
+            c->bytes, c->live);
+    objects += c->objects;
+    bytes += c->bytes;
+  }
+  fprintf(stderr, "%-12s %10zu %12zu %12zu\n", "total", objects, bytes, live);
+
+  fprintf(stderr, "\n%-12s %12s %12s %12s\n", "phase", "peak", "live",
+          "rss-kb");
+  for (int i = 0; i < nphases; i++)
+    fprintf(stderr, "%-12s %12zu %12zu %12zu\n", phases[i].name,
+            phases[i].peak, phases[i].live, phases[i].rss >> 10);
+
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+    fprintf(stderr, "\npeak rss: %ld kb\n", usage.ru_maxrss);
+}
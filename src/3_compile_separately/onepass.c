@@ -0,0 +1,470 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "c_compiler.h"
+
+// Operand of a chain of relational operators
+typedef struct {
+  Punct op;       // Operator before it; unused for the first operand
+  size_t op_pos;  // Byte offset of the operator
+  size_t pos;     // Byte offset of its first token
+  size_t end;     // Byte offset of the token after it, once compiled
+} Operand;
+
+// Chain of relational operators with a ">" or ">=", scanned ahead
+typedef struct {
+  size_t pos;    // Byte offset of its first token
+  Operand *ops;  // Operands, or NULL once taken
+  int n;         // Number of operands
+} Chain;
+
+// Chain being scanned, at one depth of parentheses
+typedef struct {
+  int base;      // Index of its first operand on the operand stack
+  bool swapped;  // Does it have a ">" or ">="
+} Frame;
+
+// Does the input have a ">", and the byte offset of its last one
+static bool has_gt;
+static size_t last_gt;
+
+// Chains scanned ahead, by offset, and the byte offset that the scan ended
+// at: every chain that starts before it has been scanned
+static Chain *chains;
+static int nchains, cap_chains;
+static size_t scan_end;
+
+// Parsing a chain again only for its diagnostics
+static bool reparsing;
+
+static void compile_expr(void);
+
+/**
+ * Check if code is still to be generated. Once an error has been reported or
+ * an input column seen, it is not, as the compilation is going to fail.
+ *
+ * @return Is it
+ */
+static bool generating(void) {
+  return error_count == 0 && !columns && !reparsing;
+}
+
+/**
+ * Generate a binary on the two values at the top of the stack, like gen().
+ *
+ * @param kind Node kind
+ */
+static void emit_binary(NodeKind kind) {
+  if (!generating()) return;
+  pop("rdi");
+  pop("rax");
+  gen_binary(kind);
+  push();
+}
+
+/**
+ * Primary expression.
+ *
+ * primary = num | ident | "(" expr ")"
+ */
+static void compile_primary(void) {
+  // case: (expr)
+  if (consume(PUNCT_LPAREN)) {
+    compile_expr();
+    expect(PUNCT_RPAREN);
+    return;
+  }
+
+  // case: input column, only recorded for the error. A local variable needs
+  // a frame laid out from the whole program.
+  Token *tok = consume_ident();
+  if (tok) {
+    if (token->kind == TK_RESERVED && token->punct == PUNCT_ASSIGN)
+      error_at(tok->pos, "local variables are not supported with --one-pass");
+    find_column(tok);
+    return;
+  }
+
+  // case: number
+  int val = expect_number();
+  if (generating()) emit("  push %d\n", val);
+}
+
+/**
+ * Unary operator expression.
+ *
+ * unary = ("+" | "-")? primary
+ */
+static void compile_unary(void) {
+  if (consume(PUNCT_SUB)) {  // -x = 0 - x
+    if (generating()) emit("  push 0\n");
+    compile_primary();
+    emit_binary(NODE_SUB);
+    return;
+  }
+  consume(PUNCT_ADD);
+  compile_primary();
+}
+
+/**
+ * Expression of multiplication and division.
+ *
+ * mul = unary ("*" unary | "/" unary)*
+ */
+static void compile_mul(void) {
+  compile_unary();
+
+  while (true) {
+    if (consume(PUNCT_MUL)) {
+      compile_unary();
+      emit_binary(NODE_MUL);
+    } else if (consume(PUNCT_DIV)) {
+      compile_unary();
+      emit_binary(NODE_DIV);
+    } else {
+      return;
+    }
+  }
+}
+
+/**
+ * Expression of addition and subtraction.
+ *
+ * add = mul ("+" mul | "-" mul)*
+ */
+static void compile_add(void) {
+  compile_mul();
+
+  while (true) {
+    if (consume(PUNCT_ADD)) {
+      compile_mul();
+      emit_binary(NODE_ADD);
+    } else if (consume(PUNCT_SUB)) {
+      compile_mul();
+      emit_binary(NODE_SUB);
+    } else {
+      return;
+    }
+  }
+}
+
+/**
+ * Check if a relational operator swaps its operands in the tree.
+ *
+ * @param op Operator
+ *
+ * @return Is it ">" or ">="
+ */
+static bool is_swapped(Punct op) {
+  return op == PUNCT_GT || op == PUNCT_GE;
+}
+
+/**
+ * Push an operand onto the operand stack of a scan.
+ *
+ * @param ops Operand stack, grown as needed
+ * @param n Number of operands on it
+ * @param cap Number of operands allocated
+ * @param op Operand
+ */
+static void push_operand(Operand **ops, int *n, int *cap, Operand op) {
+  if (*n == *cap) {
+    *ops = mem_realloc(MEM_NODE, *ops, *cap * sizeof(Operand),
+                       *cap * 2 * sizeof(Operand));
+    *cap *= 2;
+  }
+  (*ops)[(*n)++] = op;
+}
+
+/**
+ * End a scanned chain, popping its operands off the operand stack and keeping
+ * them if it has a ">" or ">=".
+ *
+ * @param ops Operand stack
+ * @param n Number of operands on it, set to the base of the chain
+ * @param frame Chain
+ */
+static void end_chain(Operand *ops, int *n, Frame *frame) {
+  if (frame->swapped) {
+    if (nchains == cap_chains) {
+      int cap = cap_chains ? cap_chains * 2 : 4;
+      chains  = mem_realloc(MEM_NODE, chains, cap_chains * sizeof(Chain),
+                            cap * sizeof(Chain));
+      cap_chains = cap;
+    }
+    Chain *chain = &chains[nchains++];
+    chain->pos   = ops[frame->base].pos;
+    chain->n     = *n - frame->base;
+    chain->ops   = mem_alloc(MEM_NODE, chain->n * sizeof(Operand));
+    memcpy(chain->ops, ops + frame->base, chain->n * sizeof(Operand));
+  }
+  *n = frame->base;
+}
+
+/**
+ * Free the chains that have been scanned and not compiled.
+ */
+static void free_chains(void) {
+  for (int i = 0; i < nchains; i++)
+    if (chains[i].ops)
+      mem_free(MEM_NODE, chains[i].ops, chains[i].n * sizeof(Operand));
+  mem_free(MEM_NODE, chains, cap_chains * sizeof(Chain));
+  chains  = NULL;
+  nchains = cap_chains = 0;
+}
+
+/**
+ * Order chains by the offset of their first operand.
+ *
+ * @param a Chain
+ * @param b Chain
+ *
+ * @return Comparison result
+ */
+static int by_pos(const void *a, const void *b) {
+  size_t x = ((Chain *)a)->pos, y = ((Chain *)b)->pos;
+  return (x > y) - (x < y);
+}
+
+/**
+ * Find the operands of the chain of relational operators that starts at the
+ * current token, and of every chain nested in its parentheses, without
+ * parsing them: they are separated by relational operators outside further
+ * parentheses, and a chain ends at the first other token there that an add
+ * expression cannot go on with. The chains with a ">" or ">=" are kept, and
+ * each token is scanned once however deep it is nested. The lexer is left
+ * where it was.
+ */
+static void scan_chains(void) {
+  free_chains();
+  size_t resume = lex_tell();
+  int nops      = 0, cap_ops = 16;
+  Operand *ops  = mem_alloc(MEM_NODE, cap_ops * sizeof(Operand));
+  int depth     = 0, cap_frames = 4;
+  Frame *frames = mem_alloc(MEM_NODE, cap_frames * sizeof(Frame));
+  frames[0]     = (Frame){0};
+  push_operand(&ops, &nops, &cap_ops, (Operand){.pos = token->pos});
+
+  Token tok    = *token;
+  bool pending = false;  // Does the top operand start at the next token
+  while (tok.kind != TK_EOF) {
+    if (tok.kind == TK_RESERVED) {
+      Punct p = tok.punct;
+      if (p == PUNCT_LPAREN) {
+        if (++depth == cap_frames) {
+          frames = mem_realloc(MEM_NODE, frames, cap_frames * sizeof(Frame),
+                               cap_frames * 2 * sizeof(Frame));
+          cap_frames *= 2;
+        }
+        frames[depth] = (Frame){.base = nops};
+        push_operand(&ops, &nops, &cap_ops, (Operand){0});
+        pending = true;
+      } else if (p == PUNCT_RPAREN || p == PUNCT_EQ || p == PUNCT_NE ||
+                 p == PUNCT_SEMI || p == PUNCT_ASSIGN) {
+        if (depth == 0) break;
+        end_chain(ops, &nops, &frames[depth]);
+        if (p == PUNCT_RPAREN) {
+          depth--;
+        } else {
+          frames[depth].swapped = false;
+          push_operand(&ops, &nops, &cap_ops, (Operand){0});
+          pending = true;
+        }
+      } else if (p != PUNCT_ADD && p != PUNCT_SUB && p != PUNCT_MUL &&
+                 p != PUNCT_DIV) {
+        frames[depth].swapped |= is_swapped(p);
+        push_operand(&ops, &nops, &cap_ops,
+                     (Operand){.op = p, .op_pos = tok.pos});
+        pending = true;
+      }
+    }
+
+    do lex_token(&tok);
+    while (tok.kind == TK_INVALID);
+
+    if (pending) {
+      ops[nops - 1].pos = tok.pos;
+      pending           = false;
+    }
+  }
+  for (; depth >= 0; depth--) end_chain(ops, &nops, &frames[depth]);
+  scan_end = tok.pos;
+
+  mem_free(MEM_NODE, frames, cap_frames * sizeof(Frame));
+  mem_free(MEM_NODE, ops, cap_ops * sizeof(Operand));
+  qsort(chains, nchains, sizeof(Chain), by_pos);
+  lex_seek(resume);
+}
+
+/**
+ * Take the operands of the scanned chain that starts at the current token.
+ *
+ * @param n Set to the number of operands
+ *
+ * @return Operands, allocated, or NULL if the chain has no ">" or ">="
+ */
+static Operand *take_chain(int *n) {
+  int lo = 0, hi = nchains;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (chains[mid].pos < token->pos)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == nchains || chains[lo].pos != token->pos) return NULL;
+
+  Operand *ops   = chains[lo].ops;
+  *n             = chains[lo].n;
+  chains[lo].ops = NULL;
+  return ops;
+}
+
+/**
+ * Compile an operand of a chain of relational operators, moving the lexer to
+ * it first.
+ *
+ * @param op Operand
+ */
+static void compile_operand(Operand *op) {
+  lex_seek(op->pos);
+  token = next_token_chunk();
+  compile_add();
+  op->end = token->pos;
+}
+
+/**
+ * Compile a chain of relational operators in source order. Code is generated
+ * for "<" and "<=" only: a chain with ">" or ">=" is only parsed in this order
+ * again for its diagnostics.
+ */
+static void compile_chain(void) {
+  compile_add();
+
+  while (true) {
+    if (consume(PUNCT_LT)) {
+      compile_add();
+      emit_binary(NODE_LT);
+    } else if (consume(PUNCT_LE)) {
+      compile_add();
+      emit_binary(NODE_LE);
+    } else if (consume(PUNCT_GT) || consume(PUNCT_GE)) {
+      compile_add();
+    } else {
+      return;
+    }
+  }
+}
+
+/**
+ * Relational expression. a > b is b < a in the tree, so that gen() generates
+ * the code of b before that of a. To generate the same code, chains are
+ * scanned ahead, and the operands of a chain that has a ">" or ">=" are
+ * compiled in the order gen() would take them, by moving the lexer back and
+ * forth: the right-hand sides of ">" and ">=" from the last, then the first
+ * operand, then the right-hand sides of "<" and "<=" in order, each followed
+ * by the operators up to it. Each operand is still parsed once, unless it has
+ * a syntax error. Once no code is generated, chains are parsed in source
+ * order.
+ *
+ * relational = add ("<" add | "<=" add | ">" add | ">=" add)*
+ */
+static void compile_relational(void) {
+  int n        = 1;
+  Operand *ops = NULL;
+  if (generating() && has_gt && last_gt >= token->pos) {
+    if (token->pos >= scan_end) scan_chains();
+    ops = take_chain(&n);
+  }
+
+  if (!ops) {
+    compile_chain();
+  } else {
+    for (int i = n - 1; i > 0; i--)
+      if (is_swapped(ops[i].op)) compile_operand(&ops[i]);
+    compile_operand(&ops[0]);
+    for (int i = 1; i < n; i++) {
+      if (!is_swapped(ops[i].op)) compile_operand(&ops[i]);
+      bool lt = ops[i].op == PUNCT_LT || ops[i].op == PUNCT_GT;
+      emit_binary(lt ? NODE_LT : NODE_LE);
+    }
+
+    if (error_count > 0) {
+      // Which errors are reported depends on the order of parsing, so they
+      // are those of parsing the chain in source order
+      error_count = 0;
+      panicking   = false;
+      reparsing   = true;
+      lex_seek(ops[0].pos);
+      token = next_token_chunk();
+      compile_chain();
+      reparsing = false;
+    } else {
+      // The parser goes on after the chain, or from an operand that stopped
+      // short of the next operator, as it would in source order; that is a
+      // syntax error, reported from there
+      int last = 0;
+      while (last < n - 1 && ops[last].end == ops[last + 1].op_pos) last++;
+      lex_seek(ops[last].end);
+      token = next_token_chunk();
+    }
+  }
+
+  if (ops) mem_free(MEM_NODE, ops, n * sizeof(Operand));
+}
+
+/**
+ * Equality expression.
+ *
+ * equality = relational ("==" relational | "!=" relational)*
+ */
+static void compile_equality(void) {
+  compile_relational();
+
+  while (true) {
+    if (consume(PUNCT_EQ)) {
+      compile_relational();
+      emit_binary(NODE_EQ);
+    } else if (consume(PUNCT_NE)) {
+      compile_relational();
+      emit_binary(NODE_NE);
+    } else {
+      return;
+    }
+  }
+}
+
+/**
+ * Expression.
+ *
+ * expr = equality
+ */
+static void compile_expr(void) {
+  compile_equality();
+}
+
+/**
+ * Parse the program from the current token and generate its stack machine
+ * code as it goes, the same code that gen() generates for the tree, leaving
+ * its value on the stack. Neither a token list nor a tree is built: tokens
+ * are pulled from the lexer on demand, and memory grows with the nesting
+ * depth and the chains with ">" scanned ahead only. The input must be in
+ * memory, since the operands of ">" are read again out of order.
+ *
+ * program = expr (";" expr)* ";"? EOF
+ */
+void gen_one_pass(void) {
+  char *gt = strrchr(user_input, '>');
+  has_gt   = gt;
+  last_gt  = gt ? gt - user_input : 0;
+  scan_end = 0;
+
+  compile_expr();
+  while (consume(PUNCT_SEMI) && !at_eof()) {
+    compile_expr();
+    emit_binary(NODE_SEQ);
+  }
+  expect_eof();
+  free_chains();
+}
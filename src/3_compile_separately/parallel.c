@@ -0,0 +1,212 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "c_compiler.h"
+
+// Largest subtree whose code is generated in one piece
+#define PIECE_NODES 4096
+
+// Tasks per worker, so that stealing can even out the load
+#define TASKS_PER_WORKER 16
+
+// Part of the sequential walk: the code for a whole subtree, or the code that
+// combines the operands of a binary, which are on the stack already, or stores
+// the value of an assignment
+typedef struct {
+  Node *node;  // Subtree or binary
+  int size;    // Nodes in the subtree if it is whole, or 0 for a binary
+} Piece;
+
+// Consecutive pieces generated into one buffer
+typedef struct {
+  size_t begin;  // First piece
+  size_t end;    // Piece after the last one
+  char *buf;     // Generated code
+  size_t len;    // Length of buf
+} Task;
+
+// Tasks of a worker; it takes them from the front and others steal from the
+// back
+typedef struct {
+  pthread_mutex_t lock;  // Guards head and tail
+  size_t head;           // First task not taken
+  size_t tail;           // Task after the last one not taken
+  pthread_t thread;      // Worker thread
+  void *mem;             // Memory counters of the worker thread
+} Deque;
+
+static Piece *pieces;
+static size_t npieces, cap_pieces;
+static Task *tasks;
+static Deque *deques;
+static int nworkers;
+
+/**
+ * Append a piece to the plan.
+ *
+ * @param node Subtree or binary
+ * @param size Nodes in the subtree if it is whole, or 0 for a binary
+ */
+static void add_piece(Node *node, int size) {
+  if (npieces == cap_pieces) {
+    size_t cap = cap_pieces ? cap_pieces * 2 : 1024;
+    pieces     = mem_realloc(MEM_CODEGEN, pieces, cap_pieces * sizeof(Piece),
+                             cap * sizeof(Piece));
+    cap_pieces = cap;
+  }
+  pieces[npieces++] = (Piece){node, size};
+}
+
+/**
+ * Cut a tree into pieces in the order gen() walks it. A subtree of at most
+ * PIECE_NODES nodes is one piece; a larger one is cut further.
+ *
+ * @param node Tree
+ *
+ * @return Number of nodes in the tree
+ */
+static size_t plan(Node *node) {
+  if (!node->lhs) {
+    add_piece(node, 1);
+    return 1;
+  }
+
+  // gen() does not push the variable an assignment stores into
+  size_t start = npieces;
+  size_t size  = node->kind == NODE_ASSIGN
+                     ? 2 + plan(node->rhs)
+                     : 1 + plan(node->lhs) + plan(node->rhs);
+  if (size <= PIECE_NODES) {
+    npieces = start;
+    add_piece(node, size);
+  } else {
+    add_piece(node, 0);
+  }
+  return size;
+}
+
+/**
+ * Generate the code for a task into its own buffer.
+ *
+ * @param task Task
+ */
+static void run_task(Task *task) {
+  output = open_memstream(&task->buf, &task->len);
+  for (size_t i = task->begin; i < task->end; i++) {
+    Piece *piece = &pieces[i];
+    if (piece->size) {
+      gen(piece->node);
+    } else if (piece->node->kind == NODE_ASSIGN) {
+      gen_store(piece->node->lhs);
+    } else {
+      pop("rdi");
+      pop("rax");
+      gen_binary(piece->node->kind);
+      push();
+    }
+  }
+  fclose(output);
+  mem_count(MEM_OUTPUT, task->len);
+}
+
+/**
+ * Take the next task of a worker, or steal the last one of another.
+ *
+ * @param deque Deque of the worker
+ * @param front Take from the front rather than the back
+ *
+ * @return Task, or NULL if the deque is empty
+ */
+static Task *take(Deque *deque, bool front) {
+  Task *task = NULL;
+  pthread_mutex_lock(&deque->lock);
+  if (deque->head < deque->tail)
+    task = &tasks[front ? deque->head++ : --deque->tail];
+  pthread_mutex_unlock(&deque->lock);
+  return task;
+}
+
+/**
+ * Run the tasks of a worker, then steal from the others until all are taken.
+ *
+ * @param arg Deque of the worker
+ *
+ * @return NULL
+ */
+static void *work(void *arg) {
+  Deque *self = arg;
+  self->mem   = mem_thread_begin();
+
+  Task *task;
+  while ((task = take(self, true))) run_task(task);
+
+  int me = self - deques;
+  for (int i = 1; i < nworkers; i++) {
+    Deque *victim = &deques[(me + i) % nworkers];
+    while ((task = take(victim, false))) run_task(task);
+  }
+  return NULL;
+}
+
+/**
+ * Generate code for a tree on several threads. The tree is cut into large
+ * independent subtrees and the code that joins them, each generated into its
+ * own buffer, and the buffers are written to output in the order of the
+ * sequential walk, so that the code is the same as gen() generates. Each
+ * thread emits to its own output.
+ *
+ * @param node Tree
+ * @param jobs Number of threads
+ */
+void gen_parallel(Node *node, int jobs) {
+  size_t grain = plan(node) / ((size_t)jobs * TASKS_PER_WORKER) + 1;
+
+  // Tasks of about grain nodes each
+  size_t ntasks = 0, cap_tasks = 0, begin = 0, size = 0;
+  for (size_t i = 0; i < npieces; i++) {
+    size += pieces[i].size ? pieces[i].size : 1;
+    if (size < grain && i + 1 < npieces) continue;
+    if (ntasks == cap_tasks) {
+      size_t cap = cap_tasks ? cap_tasks * 2 : 64;
+      tasks      = mem_realloc(MEM_CODEGEN, tasks, cap_tasks * sizeof(Task),
+                               cap * sizeof(Task));
+      cap_tasks  = cap;
+    }
+    tasks[ntasks++] = (Task){begin, i + 1};
+    begin           = i + 1;
+    size            = 0;
+  }
+
+  // Deal out the tasks in contiguous runs
+  nworkers = jobs;
+  deques   = mem_alloc(MEM_CODEGEN, jobs * sizeof(Deque));
+  for (int i = 0; i < jobs; i++) {
+    pthread_mutex_init(&deques[i].lock, NULL);
+    deques[i].head = ntasks * i / jobs;
+    deques[i].tail = ntasks * (i + 1) / jobs;
+  }
+  for (int i = 0; i < jobs; i++)
+    if (pthread_create(&deques[i].thread, NULL, work, &deques[i]))
+      error("cannot start threads");
+  for (int i = 0; i < jobs; i++) {
+    pthread_join(deques[i].thread, NULL);
+    pthread_mutex_destroy(&deques[i].lock);
+    mem_thread_merge(deques[i].mem);
+  }
+
+  for (size_t i = 0; i < ntasks; i++) {
+    fwrite(tasks[i].buf, 1, tasks[i].len, output);
+    PROBE(flush, tasks[i].len);
+    mem_free(MEM_OUTPUT, tasks[i].buf, tasks[i].len);
+  }
+
+  mem_free(MEM_CODEGEN, deques, jobs * sizeof(Deque));
+  mem_free(MEM_CODEGEN, tasks, cap_tasks * sizeof(Task));
+  mem_free(MEM_CODEGEN, pieces, cap_pieces * sizeof(Piece));
+  tasks   = NULL;
+  pieces  = NULL;
+  npieces = cap_pieces = 0;
+}
@@ -1,9 +1,12 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "c_compiler.h"
 
+Arena *node_arena;
+
 /**
  * Create a new node.
  *
@@ -12,11 +15,34 @@
  * @return New node
  */
 Node *new_node(NodeKind kind) {
-  Node *node = calloc(1, sizeof(Node));
+  Node *node = node_arena ? arena_alloc(node_arena, sizeof(Node))
+                          : mem_alloc(MEM_NODE, sizeof(Node));
   node->kind = kind;
+  PROBE(node, kind, node);
   return node;
 }
 
+/**
+ * Free a node, unless it is from node_arena, whose nodes are freed at once.
+ *
+ * @param node Node
+ */
+void free_node(Node *node) {
+  if (!node_arena) mem_free(MEM_NODE, node, sizeof(Node));
+}
+
+/**
+ * Free a subtree that a pass has rewritten away.
+ *
+ * @param node Subtree
+ */
+void free_tree(Node *node) {
+  if (!node) return;
+  free_tree(node->lhs);
+  free_tree(node->rhs);
+  free_node(node);
+}
+
 /**
  * Create a new binary.
  *
@@ -46,7 +72,82 @@ Node *new_num(int val) {
   return node;
 }
 
+Column *columns;
+
+/**
+ * Find the column named by an identifier, adding it on first use.
+ *
+ * @param tok Identifier token
+ *
+ * @return Column
+ */
+Column *find_column(Token *tok) {
+  for (Column *col = columns; col; col = col->next)
+    if (col->len == tok->len && !memcmp(col->name, tok->str, tok->len))
+      return col;
+
+  Column *col = mem_alloc(MEM_COLUMN, sizeof(Column));
+  col->next   = columns;
+  col->name   = tok->str;
+  col->len    = tok->len;
+  col->index  = columns ? columns->index + 1 : 0;
+  col->pos    = tok->pos;
+  columns     = col;
+  return col;
+}
+
+void (*on_spine)(Node *node, SpineKind kind);
+
+// Is the parser on the left spine of the program
+static bool spine;
+
+/**
+ * Parse an operand off the left spine.
+ *
+ * @param parse Parser of the operand
+ *
+ * @return Parsed node
+ */
+static Node *operand(Node *(*parse)(void)) {
+  bool saved = spine;
+  spine      = false;
+  Node *node = parse();
+  spine      = saved;
+  return node;
+}
+
+/**
+ * Pass on a subtree at the bottom of the left spine.
+ *
+ * @param node Subtree
+ *
+ * @return Subtree
+ */
+static Node *leaf(Node *node) {
+  if (spine && on_spine) on_spine(node, SPINE_LEAF);
+  return node;
+}
+
+/**
+ * Create a new binary that extends the left spine, and pass it on.
+ *
+ * @param kind Node kind
+ * @param lhs Left-hand side
+ * @param rhs Right-hand side
+ * @param part Which side is the spine so far
+ *
+ * @return New node
+ */
+static Node *extend(NodeKind kind, Node *lhs, Node *rhs, SpineKind part) {
+  Node *node = new_binary(kind, lhs, rhs);
+  if (spine && on_spine) on_spine(node, part);
+  return node;
+}
+
+Node *program();
+Node *statement();
 Node *expr();
+Node *assign();
 Node *equality();
 Node *relational();
 Node *add();
@@ -54,21 +155,79 @@ Node *mul();
 Node *unary();
 Node *primary();
 
+/**
+ * Whole program, a list of statements. Its value is that of the last one.
+ *
+ * program = expr (";" expr)* ";"? EOF
+ *
+ * @return Parsed node
+ */
+Node *program() {
+  spine      = true;
+  Node *node = expr();
+  while (consume(PUNCT_SEMI) && !at_eof())
+    node = extend(NODE_SEQ, node, operand(expr), SPINE_RHS);
+  spine = false;
+  expect_eof();
+  return node;
+}
+
+/**
+ * Next statement of the program, to compile it one statement at a time. The
+ * statements are those that program() would parse.
+ *
+ * @return Parsed node, or NULL past the last statement
+ */
+Node *statement() {
+  static bool started;
+  if (started && at_eof()) return NULL;
+  started = true;
+
+  Node *node = expr();
+  if (!consume(PUNCT_SEMI)) expect_eof();
+  return node;
+}
+
 /**
  * Expression of basic arithmetic operations.
  *
- * expr = equality
+ * expr = assign
+ * assign = ident "=" assign | equality
  * equality = relational ("==" relational | "!=" relational)*
  * relational = add ("<" add | "<=" add | ">" add | ">=" add)*
  * add = mul ("+" mul | "-" mul)*
  * mul = unary ("*" unary | "/" unary)*
  * unary = ("+" | "-")? primary
- * primary = num | "(" expr ")"
+ * primary = num | ident | "(" expr ")"
  *
  * @return Parsed node
  */
 Node *expr() {
-  return equality();
+  PROBE(expr_start, token->pos);
+  Node *node = assign();
+  PROBE(expr_done, token->pos);
+  return node;
+}
+
+/**
+ * Assignment expression. The first assignment to a name declares it as a
+ * local variable, once its right-hand side has been parsed, so that a = a + 1
+ * does not read the variable it declares.
+ *
+ * @return Parsed node
+ */
+Node *assign() {
+  if (token->kind != TK_IDENT) return equality();
+  Token *next = peek();
+  if (next->kind != TK_RESERVED || next->punct != PUNCT_ASSIGN)
+    return equality();
+
+  Token *tok = consume_ident();
+  consume(PUNCT_ASSIGN);
+  Node *rhs = operand(assign);
+  Node *var = new_node(NODE_VAR);
+  var->var  = declare_local(tok)->index;
+  return leaf(new_binary(NODE_ASSIGN, var, rhs));
 }
 
 /**
@@ -80,10 +239,10 @@ Node *equality() {
   Node *node = relational();
 
   while (true) {
-    if (consume("=="))
-      node = new_binary(NODE_EQ, node, relational());
-    else if (consume("!="))
-      node = new_binary(NODE_NE, node, relational());
+    if (consume(PUNCT_EQ))
+      node = extend(NODE_EQ, node, operand(relational), SPINE_RHS);
+    else if (consume(PUNCT_NE))
+      node = extend(NODE_NE, node, operand(relational), SPINE_RHS);
     else
       return node;
   }
@@ -98,14 +257,14 @@ Node *relational() {
   Node *node = add();
 
   while (true) {
-    if (consume("<"))
-      node = new_binary(NODE_LT, node, add());
-    else if (consume("<="))
-      node = new_binary(NODE_LE, node, add());
-    else if (consume(">"))
-      node = new_binary(NODE_LT, add(), node);
-    else if (consume(">="))
-      node = new_binary(NODE_LE, add(), node);
+    if (consume(PUNCT_LT))
+      node = extend(NODE_LT, node, operand(add), SPINE_RHS);
+    else if (consume(PUNCT_LE))
+      node = extend(NODE_LE, node, operand(add), SPINE_RHS);
+    else if (consume(PUNCT_GT))
+      node = extend(NODE_LT, operand(add), node, SPINE_LHS);
+    else if (consume(PUNCT_GE))
+      node = extend(NODE_LE, operand(add), node, SPINE_LHS);
     else
       return node;
   }
@@ -120,10 +279,10 @@ Node *add() {
   Node *node = mul();
 
   while (true) {
-    if (consume("+"))
-      node = new_binary(NODE_ADD, node, mul());
-    else if (consume("-"))
-      node = new_binary(NODE_SUB, node, mul());
+    if (consume(PUNCT_ADD))
+      node = extend(NODE_ADD, node, operand(mul), SPINE_RHS);
+    else if (consume(PUNCT_SUB))
+      node = extend(NODE_SUB, node, operand(mul), SPINE_RHS);
     else
       return node;
   }
@@ -138,10 +297,10 @@ Node *mul() {
   Node *node = unary();
 
   while (true) {
-    if (consume("*"))
-      node = new_binary(NODE_MUL, node, unary());
-    else if (consume("/"))
-      node = new_binary(NODE_DIV, node, unary());
+    if (consume(PUNCT_MUL))
+      node = extend(NODE_MUL, node, operand(unary), SPINE_RHS);
+    else if (consume(PUNCT_DIV))
+      node = extend(NODE_DIV, node, operand(unary), SPINE_RHS);
     else
       return node;
   }
@@ -153,9 +312,9 @@ Node *mul() {
  * @return Parsed node
  */
 Node *unary() {
-  if (consume("+")) return primary();
-  if (consume("-"))
-    return new_binary(NODE_SUB, new_num(0), primary());  // -x = 0 - x
+  if (consume(PUNCT_ADD)) return primary();
+  if (consume(PUNCT_SUB))  // -x = 0 - x
+    return extend(NODE_SUB, leaf(new_num(0)), operand(primary), SPINE_RHS);
   return primary();
 }
 
@@ -166,12 +325,27 @@ Node *unary() {
  */
 Node *primary() {
   // case: (expr)
-  if (consume("(")) {
+  if (consume(PUNCT_LPAREN)) {
     Node *node = expr();
-    expect(")");
+    expect(PUNCT_RPAREN);
     return node;
   }
 
+  // case: local variable or input column
+  Token *tok = consume_ident();
+  if (tok) {
+    Var *var = find_local(tok);
+    if (var) {
+      Node *node = new_node(NODE_VAR);
+      node->var  = var->index;
+      return leaf(node);
+    }
+
+    Node *node = new_node(NODE_COL);
+    node->col  = find_column(tok)->index;
+    return leaf(node);
+  }
+
   // case: number
-  return new_num(expect_number());
+  return leaf(new_num(expect_number()));
 }
@@ -0,0 +1,384 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "c_compiler.h"
+
+// Most passes a pipeline may have
+#define MAX_PASSES 16
+
+// What a pass works on
+typedef enum {
+  PASS_AST,      // Rewrites the tree
+  PASS_CODEGEN,  // Computes the tree into RAX; a pipeline has exactly one
+  PASS_ASM,      // Rewrites the generated assembly
+} PassKind;
+
+// Pass
+typedef struct {
+  char *name;                                 // Name, as in -fpass=
+  PassKind kind;                              // What it works on
+  Node *(*ast)(Node *node);                   // Run a PASS_AST
+  void (*codegen)(Node *node);                // Run a PASS_CODEGEN
+  char *(*rewrite)(char *text, size_t *len);  // Run a PASS_ASM
+} Pass;
+
+// Time taken by a pass
+typedef struct {
+  char *name;  // Pass name
+  double ms;   // Milliseconds
+} PassTime;
+
+PassOptions pass_options = {.jobs = 1};
+
+static Pass *passes[MAX_PASSES];
+static int npasses;
+static PassTime times[MAX_PASSES + 8];
+static int ntimes;
+
+/**
+ * Generate a statement as a stack machine, leaving its value in RAX.
+ *
+ * @param node Tree
+ */
+static void run_gen(Node *node) {
+  if (pass_options.jobs > 1)
+    gen_parallel(node, pass_options.jobs);
+  else
+    gen(node);
+  pop("rax");
+}
+
+/**
+ * Generate a statement by instruction selection, costed by the target.
+ *
+ * @param node Tree
+ */
+static void run_isel(Node *node) {
+  gen_isel(node, pass_options.uarch);
+}
+
+/**
+ * Schedule the generated code for the target.
+ *
+ * @param text Assembly
+ * @param len Assembly length, updated
+ *
+ * @return Scheduled assembly
+ */
+static char *run_sched(char *text, size_t *len) {
+  return schedule(text, len, pass_options.uarch);
+}
+
+static Pass pass_table[] = {
+    {"fold", PASS_AST, .ast = fold},
+    {"range", PASS_AST, .ast = narrow_ranges},
+    {"gen", PASS_CODEGEN, .codegen = run_gen},
+    {"isel", PASS_CODEGEN, .codegen = run_isel},
+    {"sched", PASS_ASM, .rewrite = run_sched},
+    {NULL},
+};
+
+// Passes of each optimization level
+static char *levels[] = {
+    "gen",
+    "fold,range,isel",
+    "fold,range,isel,sched",
+};
+
+/**
+ * Find a pass by name.
+ *
+ * @param name Name
+ * @param len Name length
+ *
+ * @return Pass, or NULL if unknown
+ */
+static Pass *find_pass(char *name, int len) {
+  for (Pass *p = pass_table; p->name; p++)
+    if (strlen(p->name) == len && !strncmp(p->name, name, len)) return p;
+  return NULL;
+}
+
+/**
+ * Replace the pipeline by a comma-separated list of passes, which run in the
+ * order given, except that every pass runs after the passes it depends on:
+ * AST passes, then code generation, then assembly passes.
+ *
+ * @param names Pass names
+ *
+ * @return False if a pass is unknown, repeated, or not exactly one pass
+ *         generates code
+ */
+bool select_passes(char *names) {
+  npasses     = 0;
+  int codegen = 0;
+  for (char *p = names; *p;) {
+    int len    = strcspn(p, ",");
+    Pass *pass = find_pass(p, len);
+    if (!pass || has_pass(pass->name) || npasses == MAX_PASSES) return false;
+    passes[npasses++] = pass;
+    codegen += pass->kind == PASS_CODEGEN;
+    p += len + (p[len] == ',');
+  }
+
+  // Stable sort by kind
+  for (int i = 1; i < npasses; i++)
+    for (int j = i; j > 0 && passes[j - 1]->kind > passes[j]->kind; j--) {
+      Pass *tmp     = passes[j];
+      passes[j]     = passes[j - 1];
+      passes[j - 1] = tmp;
+    }
+  return codegen == 1;
+}
+
+/**
+ * Select the pipeline of an optimization level: -O0 generates a stack machine,
+ * -O1 folds constants, narrows value ranges and selects instructions, and -O2
+ * also schedules them.
+ *
+ * @param level Optimization level
+ *
+ * @return False if the level is unknown
+ */
+bool select_opt_level(int level) {
+  if (level < 0 || level >= sizeof(levels) / sizeof(*levels)) return false;
+  return select_passes(levels[level]);
+}
+
+/**
+ * Add a pass to the pipeline. A code generation pass replaces the current one.
+ *
+ * @param name Pass name
+ */
+void use_pass(char *name) {
+  Pass *pass = find_pass(name, strlen(name));
+  if (has_pass(name)) return;
+
+  char buf[256] = "";
+  for (int i = 0; i < npasses; i++) {
+    bool replaced = pass->kind == PASS_CODEGEN && passes[i]->kind == pass->kind;
+    if (replaced) continue;
+    strcat(buf, passes[i]->name);
+    strcat(buf, ",");
+  }
+  strcat(buf, name);
+  select_passes(buf);
+}
+
+/**
+ * Check if the pipeline has a pass.
+ *
+ * @param name Pass name
+ *
+ * @return Does it
+ */
+bool has_pass(char *name) {
+  for (int i = 0; i < npasses; i++)
+    if (!strcmp(passes[i]->name, name)) return true;
+  return false;
+}
+
+/**
+ * Check if the pipeline rewrites the tree.
+ *
+ * @return Does it
+ */
+bool has_ast_passes(void) {
+  return npasses > 0 && passes[0]->kind == PASS_AST;
+}
+
+/**
+ * Check if the pipeline rewrites the generated assembly.
+ *
+ * @return Does it
+ */
+bool has_asm_passes(void) {
+  return npasses > 0 && passes[npasses - 1]->kind == PASS_ASM;
+}
+
+/**
+ * Get a timestamp to time a pass from.
+ *
+ * @return Milliseconds
+ */
+double pass_clock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * Record the time a pass took, adding it to that of earlier runs.
+ *
+ * @param name Pass name
+ * @param start Timestamp from pass_clock() when it started
+ */
+void pass_timed(char *name, double start) {
+  double ms = pass_clock() - start;
+  for (int i = 0; i < ntimes; i++) {
+    if (!strcmp(times[i].name, name)) {
+      times[i].ms += ms;
+      return;
+    }
+  }
+  if (ntimes == sizeof(times) / sizeof(*times)) return;
+  times[ntimes++] = (PassTime){name, ms};
+}
+
+/**
+ * Print a tree as an S-expression.
+ *
+ * @param out Output stream
+ * @param node Tree
+ */
+static void dump_tree(FILE *out, Node *node) {
+  static char *ops[] = {
+      [NODE_ADD] = "+",  [NODE_SUB] = "-",  [NODE_MUL] = "*",
+      [NODE_DIV] = "/",  [NODE_EQ] = "==",  [NODE_NE] = "!=",
+      [NODE_LT] = "<",   [NODE_LE] = "<=",  [NODE_SEQ] = ";",
+      [NODE_ASSIGN] = "=",
+  };
+
+  if (node->kind == NODE_NUM) {
+    fprintf(out, "%d", node->val);
+  } else if (node->kind == NODE_COL) {
+    fprintf(out, "$%d", node->col);
+  } else if (node->kind == NODE_VAR) {
+    Var *var = locals[node->var];
+    fprintf(out, "%.*s", (int)var->len, var->name);
+  } else {
+    fprintf(out, "(%s ", ops[node->kind]);
+    dump_tree(out, node->lhs);
+    fprintf(out, " ");
+    dump_tree(out, node->rhs);
+    fprintf(out, ")");
+  }
+}
+
+/**
+ * Check if the IR after a pass is to be dumped.
+ *
+ * @param name Pass name
+ *
+ * @return Is it
+ */
+static bool dumps(char *name) {
+  char *after = pass_options.dump_after;
+  return after && (!strcmp(after, "all") || !strcmp(after, name));
+}
+
+/**
+ * Dump the tree to stderr if requested after a pass.
+ *
+ * @param name Pass name
+ * @param node Tree
+ */
+void dump_tree_after(char *name, Node *node) {
+  if (!dumps(name)) return;
+  fprintf(stderr, "; AST after %s\n", name);
+  dump_tree(stderr, node);
+  fprintf(stderr, "\n");
+}
+
+/**
+ * Dump assembly to stderr if requested after a pass.
+ *
+ * @param name Pass name
+ * @param text Assembly
+ * @param len Assembly length
+ */
+static void dump_asm_after(char *name, char *text, size_t len) {
+  if (!dumps(name)) return;
+  fprintf(stderr, "; assembly after %s\n", name);
+  fwrite(text, 1, len, stderr);
+}
+
+/**
+ * Run the AST passes of the pipeline.
+ *
+ * @param node Tree
+ *
+ * @return Rewritten tree
+ */
+Node *run_ast_passes(Node *node) {
+  for (int i = 0; i < npasses && passes[i]->kind == PASS_AST; i++) {
+    double start = pass_clock();
+    node         = passes[i]->ast(node);
+    pass_timed(passes[i]->name, start);
+    dump_tree_after(passes[i]->name, node);
+  }
+  return node;
+}
+
+/**
+ * Generate code for a statement of main with the code generation pass of the
+ * pipeline, leaving its value in RAX.
+ *
+ * @param node Tree
+ */
+void run_codegen_statement(Node *node) {
+  for (int i = 0; i < npasses; i++) {
+    if (passes[i]->kind != PASS_CODEGEN) continue;
+    double start = pass_clock();
+    passes[i]->codegen(node);
+    pass_timed(passes[i]->name, start);
+  }
+}
+
+/**
+ * Generate main with the code generation pass of the pipeline, in a frame for
+ * its local variables if it has any.
+ *
+ * @param node Tree
+ */
+void run_codegen(Node *node) {
+  layout_frame(node);
+  gen_header();
+  run_codegen_statement(node);
+  ret();
+}
+
+/**
+ * Run the assembly passes of the pipeline, dumping the generated code first if
+ * requested. Each pass returns a new buffer, and the one it rewrote is freed.
+ *
+ * @param text Assembly, counted as output memory
+ * @param len Assembly length, updated
+ *
+ * @return Rewritten assembly
+ */
+char *run_asm_passes(char *text, size_t *len) {
+  for (int i = 0; i < npasses; i++)
+    if (passes[i]->kind == PASS_CODEGEN)
+      dump_asm_after(passes[i]->name, text, *len);
+
+  for (int i = 0; i < npasses; i++) {
+    if (passes[i]->kind != PASS_ASM) continue;
+    double start    = pass_clock();
+    size_t text_len = *len;
+    char *rewritten = passes[i]->rewrite(text, len);
+    pass_timed(passes[i]->name, start);
+    mem_count(MEM_OUTPUT, *len);
+    mem_free(MEM_OUTPUT, text, text_len);
+    text = rewritten;
+    dump_asm_after(passes[i]->name, text, *len);
+  }
+  return text;
+}
+
+/**
+ * Print the time each pass took to stderr.
+ */
+void print_pass_times(void) {
+  double total = 0;
+  fprintf(stderr, "%-12s %10s\n", "pass", "ms");
+  for (int i = 0; i < ntimes; i++) {
+    fprintf(stderr, "%-12s %10.3f\n", times[i].name, times[i].ms);
+    total += times[i].ms;
+  }
+  fprintf(stderr, "%-12s %10.3f\n", "total", total);
+}
@@ -0,0 +1,308 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "c_compiler.h"
+
+// Tokens per chunk handed from the lexer to the parser
+#define CHUNK_TOKENS 4096
+
+// Slots of each ring buffer, a power of two
+#define RING_SIZE 64
+
+// Chunks of tokens in flight between the lexer and the parser
+#define NUM_CHUNKS RING_SIZE
+
+// Stack size of the code generator, which recurses as deep as the operands
+#define GEN_STACK_SIZE (256 << 20)
+
+// Lock-free ring buffer of pointers with a single producer and consumer
+typedef struct {
+  void *items[RING_SIZE];       // Items
+  _Atomic size_t head;          // Items read so far, written by the consumer
+  _Atomic size_t tail;          // Items written so far, written by the producer
+} Ring;
+
+// Tokens read by the lexer thread
+typedef struct {
+  Token tokens[CHUNK_TOKENS];  // Tokens, with TK_EOF last in the last chunk
+  int len;                     // Number of tokens
+} TokenChunk;
+
+// Part of the left spine handed from the parser to the code generator
+typedef struct {
+  Node *node;      // Subtree or binary
+  SpineKind kind;  // Part, or -1 for the end of the program
+} Step;
+
+static Ring lexed;       // Lexer to parser: chunks of tokens
+static Ring free_chunks; // Parser to lexer: chunks to reuse
+static Ring steps;       // Parser to code generator: parts of the spine
+static Ring done;        // Code generator to parser: steps to free
+
+static TokenChunk *chunks[NUM_CHUNKS];
+static TokenChunk *current, *previous;
+static pthread_t lexer, generator;
+static void *generator_mem;
+static FILE *generator_output;
+
+/**
+ * Add an item to a ring buffer unless it is full.
+ *
+ * @param ring Ring buffer
+ * @param item Item
+ *
+ * @return False if the ring buffer is full
+ */
+static bool ring_push(Ring *ring, void *item) {
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  if (tail - atomic_load_explicit(&ring->head, memory_order_acquire) ==
+      RING_SIZE)
+    return false;
+
+  ring->items[tail % RING_SIZE] = item;
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+  return true;
+}
+
+/**
+ * Take the oldest item from a ring buffer.
+ *
+ * @param ring Ring buffer
+ *
+ * @return Item, or NULL if the ring buffer is empty
+ */
+static void *ring_pop(Ring *ring) {
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  if (head == atomic_load_explicit(&ring->tail, memory_order_acquire))
+    return NULL;
+
+  void *item = ring->items[head % RING_SIZE];
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  return item;
+}
+
+/**
+ * Wait for a moment, for the other end of a ring buffer.
+ *
+ * @param spins Times waited so far, updated
+ */
+static void backoff(int *spins) {
+  if (++*spins < 64)
+    __builtin_ia32_pause();
+  else
+    sched_yield();
+}
+
+/**
+ * Add an item to a ring buffer, waiting while it is full.
+ *
+ * @param ring Ring buffer
+ * @param item Item
+ */
+static void ring_push_wait(Ring *ring, void *item) {
+  for (int spins = 0; !ring_push(ring, item);) backoff(&spins);
+}
+
+/**
+ * Take the oldest item from a ring buffer, waiting while it is empty.
+ *
+ * @param ring Ring buffer
+ *
+ * @return Item
+ */
+static void *ring_pop_wait(Ring *ring) {
+  void *item;
+  for (int spins = 0; !(item = ring_pop(ring));) backoff(&spins);
+  return item;
+}
+
+/**
+ * Tokenize the input into chunks and pass them to the parser.
+ *
+ * @param arg Unused
+ *
+ * @return NULL
+ */
+static void *lex(void *arg) {
+  bool eof = false;
+
+  while (!eof) {
+    TokenChunk *chunk = ring_pop_wait(&free_chunks);
+    chunk->len        = 0;
+    while (chunk->len < CHUNK_TOKENS && !eof) {
+      Token *tok = &chunk->tokens[chunk->len++];
+      lex_token(tok);
+      eof = tok->kind == TK_EOF;
+    }
+    ring_push_wait(&lexed, chunk);
+  }
+  return NULL;
+}
+
+/**
+ * Take the next chunk from the lexer, report its invalid tokens and link the
+ * others. The chunk before the current one goes back to the lexer; it is kept
+ * until now because the parser may still hold a token from it.
+ *
+ * @return First token of the chunk
+ */
+static Token *receive_chunk(void) {
+  while (true) {
+    if (previous) ring_push_wait(&free_chunks, previous);
+    previous = current;
+    current  = ring_pop_wait(&lexed);
+
+    Token head = {};
+    Token *cur = &head;
+    for (int i = 0; i < current->len; i++) {
+      Token *tok = &current->tokens[i];
+      if (tok->kind == TK_INVALID) {
+        report_at(tok->pos, "invalid token");
+        continue;
+      }
+      cur->next = tok;
+      cur       = tok;
+    }
+    cur->next = NULL;
+    if (head.next) return head.next;
+  }
+}
+
+/**
+ * Free the nodes of a step that the code generator is done with. The spine
+ * below a binary was freed with the steps that built it.
+ *
+ * @param step Step
+ */
+static void free_step(Step *step) {
+  Node *node = step->node;
+  if (step->kind == SPINE_LEAF) {
+    free_tree(node);
+  } else {
+    free_tree(step->kind == SPINE_RHS ? node->rhs : node->lhs);
+    mem_free(MEM_NODE, node, sizeof(Node));
+  }
+  mem_free(MEM_NODE, step, sizeof(Step));
+}
+
+/**
+ * Free the steps that the code generator is done with.
+ */
+static void reclaim(void) {
+  Step *step;
+  while ((step = ring_pop(&done))) free_step(step);
+}
+
+/**
+ * Pass a part of the left spine to the code generator. Once an error has been
+ * reported, or an input column or a local variable seen, code is no longer
+ * generated, as the compilation is going to fail.
+ *
+ * @param node Subtree or binary
+ * @param kind Part
+ */
+static void hand_off(Node *node, SpineKind kind) {
+  if (error_count > 0 || columns || nlocals) return;
+
+  Step *step = mem_alloc(MEM_NODE, sizeof(Step));
+  step->node = node;
+  step->kind = kind;
+
+  reclaim();
+  for (int spins = 0; !ring_push(&steps, step);) {
+    reclaim();
+    backoff(&spins);
+  }
+}
+
+/**
+ * Generate code for the parts of the left spine in the order they arrive.
+ *
+ * @param arg Unused
+ *
+ * @return NULL
+ */
+static void *generate(void *arg) {
+  generator_mem = mem_thread_begin();
+  output        = generator_output;
+  gen_header();
+
+  while (true) {
+    Step *step = ring_pop_wait(&steps);
+    if ((int)step->kind < 0) break;
+
+    if (step->kind == SPINE_LEAF) {
+      gen(step->node);
+    } else {
+      // The spine so far is on the stack already. Bring the other operand
+      // onto it and pop both into the registers gen() would have.
+      bool rhs = step->kind == SPINE_RHS;
+      gen(rhs ? step->node->rhs : step->node->lhs);
+      pop(rhs ? "rdi" : "rax");
+      pop(rhs ? "rax" : "rdi");
+      gen_binary(step->node->kind);
+      push();
+    }
+    ring_push_wait(&done, step);
+  }
+
+  pop("rax");
+  ret();
+  return NULL;
+}
+
+/**
+ * Start a lexer thread that feeds the parser with chunks of tokens, and a code
+ * generator thread that the parser feeds with the parts of the left spine of
+ * the program, and make the first token current. Each runs at most a bounded
+ * amount of work ahead of the parser.
+ */
+void pipeline_start(void) {
+  for (int i = 0; i < NUM_CHUNKS; i++) {
+    chunks[i] = mem_alloc(MEM_TOKEN, sizeof(TokenChunk));
+    ring_push(&free_chunks, chunks[i]);
+  }
+
+  generator_output = output;
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, GEN_STACK_SIZE);
+  if (pthread_create(&lexer, NULL, lex, NULL) ||
+      pthread_create(&generator, &attr, generate, NULL))
+    error("cannot start threads");
+  pthread_attr_destroy(&attr);
+
+  next_token_chunk = receive_chunk;
+  on_spine         = hand_off;
+  token            = receive_chunk();
+}
+
+/**
+ * Wait for the code generator to finish the program and stop the threads.
+ */
+void pipeline_finish(void) {
+  // The end of the program goes through even after an error
+  Step *end = mem_alloc(MEM_NODE, sizeof(Step));
+  end->kind = -1;
+  for (int spins = 0; !ring_push(&steps, end);) {
+    reclaim();
+    backoff(&spins);
+  }
+
+  pthread_join(lexer, NULL);
+  pthread_join(generator, NULL);
+  reclaim();
+  mem_free(MEM_NODE, end, sizeof(Step));
+  mem_thread_merge(generator_mem);
+  for (int i = 0; i < NUM_CHUNKS; i++)
+    mem_free(MEM_TOKEN, chunks[i], sizeof(TokenChunk));
+
+  next_token_chunk = NULL;
+  on_spine         = NULL;
+}
@@ -0,0 +1,304 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "c_compiler.h"
+
+// Values a node may have, as the generated code computes it in 64 bits
+typedef struct {
+  int64_t min;  // Smallest value
+  int64_t max;  // Largest value
+  bool traps;   // Can computing it divide by zero or overflow a division
+  bool writes;  // Does computing it assign a local variable
+} Interval;
+
+// Any value
+static const Interval any = {INT64_MIN, INT64_MAX};
+
+// Sites rewritten by each rule
+static long rewrites[NUM_REWRITES];
+
+static char *rewrite_names[] = {
+    [REWRITE_CONST] = "const",   [REWRITE_TEST] = "test",
+    [REWRITE_DEAD] = "dead",     [REWRITE_DIV32] = "div32",
+    [REWRITE_IMUL32] = "imul32", [REWRITE_MOVZB] = "movzb",
+};
+
+/**
+ * Get the interval of a sum or difference. One that may wrap around can be
+ * anything.
+ *
+ * @param kind NODE_ADD or NODE_SUB
+ * @param a Left-hand side
+ * @param b Right-hand side
+ *
+ * @return Interval
+ */
+static Interval add_sub(NodeKind kind, Interval a, Interval b) {
+  Interval r;
+  bool wraps = kind == NODE_ADD
+                   ? __builtin_add_overflow(a.min, b.min, &r.min) |
+                         __builtin_add_overflow(a.max, b.max, &r.max)
+                   : __builtin_sub_overflow(a.min, b.max, &r.min) |
+                         __builtin_sub_overflow(a.max, b.min, &r.max);
+  return wraps ? any : r;
+}
+
+/**
+ * Widen an interval to a value.
+ *
+ * @param r Interval
+ * @param val Value
+ */
+static void widen(Interval *r, int64_t val) {
+  if (val < r->min) r->min = val;
+  if (val > r->max) r->max = val;
+}
+
+/**
+ * Get the interval of a product. It is that of the products of the bounds,
+ * unless one of those wraps around.
+ *
+ * @param a Left-hand side
+ * @param b Right-hand side
+ *
+ * @return Interval
+ */
+static Interval product(Interval a, Interval b) {
+  Interval r    = {INT64_MAX, INT64_MIN};
+  int64_t xs[2] = {a.min, a.max}, ys[2] = {b.min, b.max};
+  for (int i = 0; i < 2; i++) {
+    for (int j = 0; j < 2; j++) {
+      int64_t val;
+      if (__builtin_mul_overflow(xs[i], ys[j], &val)) return any;
+      widen(&r, val);
+    }
+  }
+  return r;
+}
+
+/**
+ * Get the interval of a quotient. A quotient only grows in magnitude towards
+ * the bounds of the dividend and towards divisors of 1 and -1, so it is
+ * bounded by the quotients of those that the divisor may be.
+ *
+ * @param a Dividend
+ * @param b Divisor
+ *
+ * @return Interval; any value if the division always traps
+ */
+static Interval quotient(Interval a, Interval b) {
+  Interval r    = {INT64_MAX, INT64_MIN};
+  int64_t xs[2] = {a.min, a.max}, ys[4] = {b.min, b.max, -1, 1};
+  for (int j = 0; j < 4; j++) {
+    if (ys[j] == 0 || ys[j] < b.min || ys[j] > b.max) continue;
+    for (int i = 0; i < 2; i++) {
+      if (xs[i] == INT64_MIN && ys[j] == -1) return any;
+      widen(&r, xs[i] / ys[j]);
+    }
+  }
+  return r.min <= r.max ? r : any;
+}
+
+/**
+ * Get the interval of a comparison: the result if the intervals of the
+ * operands decide it, 0 or 1 otherwise.
+ *
+ * @param kind Node kind
+ * @param a Left-hand side
+ * @param b Right-hand side
+ *
+ * @return Interval
+ */
+static Interval compare(NodeKind kind, Interval a, Interval b) {
+  // Whether it is always true, and whether it is always false
+  bool yes, no;
+  switch (kind) {
+    case NODE_EQ:
+    case NODE_NE:
+      yes = a.min == a.max && b.min == b.max && a.min == b.min;
+      no  = a.max < b.min || b.max < a.min;
+      if (kind == NODE_NE) {
+        bool tmp = yes;
+        yes      = no;
+        no       = tmp;
+      }
+      break;
+    case NODE_LT:
+      yes = a.max < b.min;
+      no  = a.min >= b.max;
+      break;
+    default:
+      yes = a.max <= b.min;
+      no  = a.min > b.max;
+      break;
+  }
+  return (Interval){yes, !no};
+}
+
+/**
+ * Get the interval of a binary from those of its operands.
+ *
+ * @param kind Node kind
+ * @param a Left-hand side
+ * @param b Right-hand side
+ *
+ * @return Interval
+ */
+static Interval binary(NodeKind kind, Interval a, Interval b) {
+  Interval r;
+  switch (kind) {
+    case NODE_ADD:
+    case NODE_SUB:
+      r = add_sub(kind, a, b);
+      break;
+    case NODE_MUL:
+      r = product(a, b);
+      break;
+    case NODE_DIV:
+      r = quotient(a, b);
+      break;
+    case NODE_SEQ:
+    case NODE_ASSIGN:
+      r = b;
+      break;
+    default:
+      r = compare(kind, a, b);
+      break;
+  }
+
+  // idiv traps on a zero divisor and on a quotient that overflows
+  r.traps = a.traps || b.traps ||
+            (kind == NODE_DIV &&
+             ((b.min <= 0 && b.max >= 0) ||
+              (a.min == INT64_MIN && b.min <= -1 && b.max >= -1)));
+  r.writes = a.writes || b.writes || kind == NODE_ASSIGN;
+  return r;
+}
+
+/**
+ * Check if a comparison of a boolean with 0 or 1 is the boolean itself, as in
+ * b != 0, b == 1, b > 0 and b >= 1.
+ *
+ * @param node Comparison
+ * @param a Interval of the left-hand side
+ * @param b Interval of the right-hand side
+ *
+ * @return The boolean, or NULL if it is not such a comparison
+ */
+static Node *tested_bool(Node *node, Interval a, Interval b) {
+  Node *lhs = node->lhs, *rhs = node->rhs;
+  bool lbool = a.min >= 0 && a.max <= 1, rbool = b.min >= 0 && b.max <= 1;
+  switch (node->kind) {
+    case NODE_EQ:
+    case NODE_NE: {
+      int val = node->kind == NODE_EQ;
+      if (lbool && rhs->kind == NODE_NUM && rhs->val == val) return lhs;
+      if (rbool && lhs->kind == NODE_NUM && lhs->val == val) return rhs;
+      return NULL;
+    }
+    case NODE_LT:
+      return rbool && lhs->kind == NODE_NUM && lhs->val == 0 ? rhs : NULL;
+    case NODE_LE:
+      return rbool && lhs->kind == NODE_NUM && lhs->val == 1 ? rhs : NULL;
+    default:
+      return NULL;
+  }
+}
+
+/**
+ * Compute the interval of every node of a tree, bottom-up, rewrite the nodes
+ * it makes redundant, and record facts about the value of the others.
+ *
+ * @param node Tree
+ * @param r Set to the interval of the rewritten tree
+ *
+ * @return Rewritten tree
+ */
+static Node *narrow(Node *node, Interval *r) {
+  if (node->kind == NODE_NUM) {
+    *r = (Interval){node->val, node->val};
+  } else if (node->kind == NODE_COL || node->kind == NODE_VAR) {
+    *r = any;
+  } else {
+    Interval a, b;
+    node->lhs = narrow(node->lhs, &a);
+    node->rhs = narrow(node->rhs, &b);
+    *r        = binary(node->kind, a, b);
+
+    Node *keep = NULL;
+    if (!r->traps && !r->writes && r->min == r->max && r->min >= INT32_MIN &&
+        r->min <= INT32_MAX) {
+      free_tree(node->lhs);
+      free_tree(node->rhs);
+      *node = (Node){.kind = NODE_NUM, .val = r->min};
+      count_rewrite(REWRITE_CONST);
+    } else if ((keep = tested_bool(node, a, b))) {
+      count_rewrite(REWRITE_TEST);
+    } else if (node->kind == NODE_SEQ && !a.traps && !a.writes) {
+      keep = node->rhs;
+      count_rewrite(REWRITE_DEAD);
+    }
+
+    if (keep) {
+      bool left = keep == node->lhs;
+      free_tree(left ? node->rhs : node->lhs);
+      free_node(node);
+      *r   = left ? a : b;
+      node = keep;
+    }
+  }
+
+  node->facts = 0;
+  if (r->min >= 0 && r->max <= 1) node->facts |= 1 << FACT_BOOL;
+  if (r->min >= 0 && r->max <= UINT32_MAX) node->facts |= 1 << FACT_U32;
+  return node;
+}
+
+/**
+ * Propagate the interval of values that each node may have, as the generated
+ * code computes it in 64 bits, and use it to drop redundant operations:
+ * subtrees with a known value that cannot trap or assign become numbers,
+ * comparisons of a boolean with 0 or 1 become the boolean, and statements
+ * that cannot trap or assign are dropped unless they are the last. Local
+ * variables may have any value. The other nodes are given facts
+ * about their value that let code generation use narrower instructions.
+ *
+ * @param node Tree
+ *
+ * @return Rewritten tree
+ */
+Node *narrow_ranges(Node *node) {
+  Interval r;
+  return narrow(node, &r);
+}
+
+/**
+ * Check if the range pass has proven a fact about the value of a node.
+ *
+ * @param node Node
+ * @param fact Fact
+ *
+ * @return Has it
+ */
+bool has_fact(Node *node, Fact fact) {
+  return node->facts & 1 << fact;
+}
+
+/**
+ * Count a site rewritten by a rule.
+ *
+ * @param rewrite Rule
+ */
+void count_rewrite(Rewrite rewrite) {
+  rewrites[rewrite]++;
+}
+
+/**
+ * Print the number of sites each rule rewrote to stderr.
+ */
+void print_rewrite_stats(void) {
+  fprintf(stderr, "%-12s %10s\n", "rewrite", "sites");
+  for (int i = 0; i < NUM_REWRITES; i++)
+    fprintf(stderr, "%-12s %10ld\n", rewrite_names[i], rewrites[i]);
+}
@@ -0,0 +1,784 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "c_compiler.h"
+
+// Blocks are scheduled in windows of at most this many instructions, which
+// bounds the quadratic DAG construction on huge expressions
+#define SCHED_WINDOW 1024
+
+// Names of each register family by operand size: 64, 32 and 8 bits
+static char *reg_names[NUM_REGS][3] = {
+    {"rax", "eax", "al"},    {"rcx", "ecx", "cl"},    {"rdx", "edx", "dl"},
+    {"rbx", "ebx", "bl"},    {"rsp", "esp", "spl"},   {"rbp", "ebp", "bpl"},
+    {"rsi", "esi", "sil"},   {"rdi", "edi", "dil"},   {"r8", "r8d", "r8b"},
+    {"r9", "r9d", "r9b"},    {"r10", "r10d", "r10b"}, {"r11", "r11d", "r11b"},
+    {"r12", "r12d", "r12b"}, {"r13", "r13d", "r13b"}, {"r14", "r14d", "r14b"},
+    {"r15", "r15d", "r15b"},
+};
+
+// Latency, reciprocal throughput and execution ports of each instruction
+// class, after Agner Fog's instruction tables. The latency of a store is that
+// of forwarding it to a later load. Ports are numbered as in Intel's and AMD's
+// manuals; on Zen 3, ports 0-3 are the integer ALUs and 4-6 the AGUs.
+#define P(n) (1u << (n))
+Uarch uarchs[] = {
+    {"generic",
+     4,
+     {
+         [CLS_MOV]    = {1, 0.25, P(0) | P(1) | P(5) | P(6)},
+         [CLS_ALU]    = {1, 0.25, P(0) | P(1) | P(5) | P(6)},
+         [CLS_LEA]    = {1, 0.5, P(1) | P(5)},
+         [CLS_LOAD]   = {5, 0.5, P(2) | P(3)},
+         [CLS_STORE]  = {5, 1, P(4)},
+         [CLS_IMUL]   = {3, 1, P(1)},
+         [CLS_CQO]    = {1, 0.5, P(0) | P(6)},
+         [CLS_DIV]    = {40, 25, P(0)},
+         [CLS_DIV32]  = {26, 6, P(0)},
+         [CLS_SETCC]  = {1, 0.5, P(0) | P(6)},
+         [CLS_MOVZX]  = {1, 0.25, P(0) | P(1) | P(5) | P(6)},
+         [CLS_BRANCH] = {1, 0.5, P(0) | P(6)},
+     }},
+    {"skylake",
+     4,
+     {
+         [CLS_MOV]    = {1, 0.25, P(0) | P(1) | P(5) | P(6)},
+         [CLS_ALU]    = {1, 0.25, P(0) | P(1) | P(5) | P(6)},
+         [CLS_LEA]    = {1, 0.5, P(1) | P(5)},
+         [CLS_LOAD]   = {5, 0.5, P(2) | P(3)},
+         [CLS_STORE]  = {4, 1, P(4)},
+         [CLS_IMUL]   = {3, 1, P(1)},
+         [CLS_CQO]    = {1, 0.5, P(0) | P(6)},
+         [CLS_DIV]    = {42, 24, P(0)},
+         [CLS_DIV32]  = {26, 6, P(0)},
+         [CLS_SETCC]  = {1, 0.5, P(0) | P(6)},
+         [CLS_MOVZX]  = {1, 0.25, P(0) | P(1) | P(5) | P(6)},
+         [CLS_BRANCH] = {1, 0.5, P(0) | P(6)},
+     }},
+    {"zen3",
+     6,
+     {
+         [CLS_MOV]    = {1, 0.25, P(0) | P(1) | P(2) | P(3)},
+         [CLS_ALU]    = {1, 0.25, P(0) | P(1) | P(2) | P(3)},
+         [CLS_LEA]    = {1, 0.25, P(0) | P(1) | P(2) | P(3)},
+         [CLS_LOAD]   = {4, 0.33, P(4) | P(5) | P(6)},
+         [CLS_STORE]  = {6, 0.5, P(4) | P(5)},
+         [CLS_IMUL]   = {3, 1, P(1)},
+         [CLS_CQO]    = {1, 0.25, P(0) | P(1) | P(2) | P(3)},
+         [CLS_DIV]    = {14, 7, P(2)},
+         [CLS_DIV32]  = {10, 6, P(2)},
+         [CLS_SETCC]  = {1, 0.5, P(0) | P(3)},
+         [CLS_MOVZX]  = {1, 0.25, P(0) | P(1) | P(2) | P(3)},
+         [CLS_BRANCH] = {1, 0.5, P(0) | P(3)},
+     }},
+    {NULL},
+};
+
+/**
+ * Find a microarchitecture by name.
+ *
+ * @param name Name
+ *
+ * @return Microarchitecture, or NULL if unknown
+ */
+Uarch *find_uarch(char *name) {
+  for (Uarch *u = uarchs; u->name; u++)
+    if (!strcmp(u->name, name)) return u;
+  return NULL;
+}
+
+/**
+ * Look up a register name.
+ *
+ * @param name Name, not necessarily NUL-terminated
+ * @param len Name length
+ * @param size Set to the operand size, as an index into reg_names
+ *
+ * @return Register family, or -1 if name is not a general purpose register
+ */
+static int find_reg(char *name, int len, int *size) {
+  for (int r = 0; r < NUM_REGS; r++)
+    for (int s = 0; s < 3; s++)
+      if (strlen(reg_names[r][s]) == len &&
+          !strncmp(reg_names[r][s], name, len)) {
+        *size = s;
+        return r;
+      }
+  return -1;
+}
+
+/**
+ * Collect the general purpose registers mentioned in an operand.
+ *
+ * @param arg Operand
+ * @param ok Cleared if the operand mentions a name that is neither a general
+ *           purpose register nor a size keyword, e.g. a vector register
+ *
+ * @return Register families, by bit 1 << Reg
+ */
+static uint32_t operand_regs(char *arg, bool *ok) {
+  uint32_t regs = 0;
+  for (char *p = arg; *p;) {
+    if (!isalpha(*p)) {
+      p++;
+      continue;
+    }
+
+    char *q = p;
+    while (isalnum(*p)) p++;
+    int size, r = find_reg(q, p - q, &size);
+    if (r >= 0)
+      regs |= 1u << r;
+    else if (strncmp(q, "qword ", 6) && strncmp(q, "ptr ", 4))
+      *ok = false;
+  }
+  return regs;
+}
+
+/**
+ * Get the stack slot of a memory operand.
+ *
+ * @param arg Operand
+ *
+ * @return Offset from RSP, or -1 if the operand is not a stack slot
+ */
+static int operand_slot(char *arg) {
+  char *p = strstr(arg, "[rsp");
+  if (!p) return -1;
+  p += 4;
+  if (*p == ']') return 0;
+  if (strncmp(p, " + ", 3)) return -1;
+
+  char *end;
+  long off = strtol(p + 3, &end, 10);
+  return *end == ']' ? off : -1;
+}
+
+/**
+ * Parse an instruction line such as "  add rax, rdi".
+ *
+ * @param line Line without the trailing newline
+ * @param inst Set to the instruction
+ *
+ * @return False if the line is a label, directive or comment
+ */
+bool parse_inst(char *line, Inst *inst) {
+  memset(inst, 0, sizeof(*inst));
+  if (line[0] != ' ') return false;
+
+  while (*line == ' ') line++;
+  int n = 0;
+  while (*line && *line != ' ' && n < sizeof(inst->op) - 1)
+    inst->op[n++] = *line++;
+  while (*line == ' ') line++;
+
+  while (*line && inst->nargs < 3) {
+    char *end = strstr(line, ", ");
+    int len   = end ? end - line : strlen(line);
+    if (len >= sizeof(inst->arg[0])) len = sizeof(inst->arg[0]) - 1;
+    memcpy(inst->arg[inst->nargs++], line, len);
+    line = end ? end + 2 : line + strlen(line);
+  }
+  return true;
+}
+
+/**
+ * Work out the class of an instruction and which registers, flags and memory
+ * it reads and writes.
+ *
+ * @param inst Parsed instruction
+ *
+ * @return False if this pass does not understand the instruction
+ */
+bool analyze_inst(Inst *inst) {
+  char *op         = inst->op;
+  char *dst        = inst->arg[0], *src = inst->arg[1];
+  bool imul3       = !strcmp(op, "imul") && inst->nargs == 3;
+  bool ok          = inst->nargs <= 2 || imul3;
+  bool dst_mem     = inst->nargs > 0 && strchr(dst, '[');
+  bool src_mem     = inst->nargs > 1 && strchr(src, '[');
+  int size, reg    = inst->nargs > 0 ? find_reg(dst, strlen(dst), &size) : -1;
+  uint32_t dst_reg = reg >= 0 ? 1u << reg : 0;
+  uint32_t uses    = 0, defs = 0, fixed = 0;
+
+  // Registers in addressing modes and source operands are read
+  inst->slot = -1;
+  if (inst->nargs > 1) uses |= operand_regs(src, &ok);
+  if (dst_mem) uses |= operand_regs(dst, &ok);
+  if (dst_mem || src_mem) inst->slot = operand_slot(dst_mem ? dst : src);
+
+  if (!strcmp(op, "mov")) {
+    // Writing an 8-bit register merges into the rest of it
+    defs |= dst_reg;
+    if (reg >= 0 && size == 2) uses |= dst_reg;
+    ok &= reg >= 0 || dst_mem;
+    inst->cls = dst_mem ? CLS_STORE : src_mem ? CLS_LOAD : CLS_MOV;
+  } else if (!strcmp(op, "movzb") || !strcmp(op, "movzx")) {
+    defs |= dst_reg;
+    ok &= reg >= 0 && !src_mem;
+    inst->cls = CLS_MOVZX;
+  } else if (!strcmp(op, "add") || !strcmp(op, "sub") || !strcmp(op, "and") ||
+             !strcmp(op, "or") || !strcmp(op, "xor") ||
+             (!strcmp(op, "imul") && inst->nargs == 2)) {
+    // xor r, r and sub r, r zero r without reading it
+    bool zero = (op[0] == 'x' || op[0] == 's') && !strcmp(dst, src);
+    if (!zero) uses |= dst_reg;
+    defs |= dst_reg | 1u << REG_FLAGS;
+    ok &= reg >= 0 && !src_mem;
+    inst->cls = op[0] == 'i' ? CLS_IMUL : CLS_ALU;
+  } else if (imul3) {
+    // imul dst, src, imm only writes dst
+    defs |= dst_reg | 1u << REG_FLAGS;
+    char *imm = inst->arg[2];
+    ok &= reg >= 0 && !src_mem && (isdigit(*imm) || *imm == '-');
+    inst->cls = CLS_IMUL;
+  } else if (!strcmp(op, "cmp")) {
+    uses |= dst_reg;
+    defs |= 1u << REG_FLAGS;
+    ok &= reg >= 0 && !src_mem;
+    inst->cls = CLS_ALU;
+  } else if (!strcmp(op, "inc") || !strcmp(op, "dec") || !strcmp(op, "neg")) {
+    uses |= dst_reg;
+    defs |= dst_reg | 1u << REG_FLAGS;
+    ok &= reg >= 0;
+    inst->cls = CLS_ALU;
+  } else if (!strcmp(op, "imul") || !strcmp(op, "idiv") ||
+             !strcmp(op, "div")) {
+    // The one-operand forms work on RDX:RAX, or EDX:EAX with a 32-bit one
+    bool div32 = op[1] != 'm' &&
+                 (reg >= 0 ? size == 1 : !strncmp(dst, "dword", 5));
+    inst->cls = op[1] == 'm' ? CLS_IMUL : div32 ? CLS_DIV32 : CLS_DIV;
+    uses |= dst_reg;
+    uses |= 1u << REG_RAX;
+    if (inst->cls != CLS_IMUL) uses |= 1u << REG_RDX;
+    defs |= 1u << REG_RAX | 1u << REG_RDX | 1u << REG_FLAGS;
+    fixed |= 1u << REG_RAX | 1u << REG_RDX;
+    ok &= inst->nargs == 1 && (reg >= 0 || dst_mem);
+  } else if (!strcmp(op, "cqo")) {
+    uses |= 1u << REG_RAX;
+    defs |= 1u << REG_RDX;
+    fixed |= 1u << REG_RAX | 1u << REG_RDX;
+    inst->cls = CLS_CQO;
+  } else if (!strcmp(op, "lea")) {
+    defs |= dst_reg;
+    ok &= reg >= 0;
+    inst->cls = CLS_LEA;
+  } else if (!strncmp(op, "set", 3)) {
+    uses |= 1u << REG_FLAGS | dst_reg;
+    defs |= dst_reg;
+    ok &= reg >= 0;
+    inst->cls = CLS_SETCC;
+  } else if (!strcmp(op, "ret")) {
+    uses |= 1u << REG_RAX | 1u << REG_RSP;
+    fixed |= 1u << REG_RAX;
+    inst->cls = CLS_BRANCH;
+  } else if (op[0] == 'j') {
+    uses |= 1u << REG_FLAGS;
+    inst->cls = CLS_BRANCH;
+  } else {
+    return false;
+  }
+
+  inst->uses       = uses;
+  inst->defs       = defs;
+  inst->fixed      = fixed;
+  inst->stores     = inst->cls == CLS_STORE;
+  inst->terminator = inst->cls == CLS_BRANCH;
+
+  // lea computes an address without accessing memory
+  inst->loads = inst->cls != CLS_LEA && !inst->stores && (dst_mem || src_mem);
+  return ok;
+}
+
+/**
+ * Write an instruction as a line of assembly.
+ *
+ * @param out Output stream
+ * @param inst Instruction
+ */
+static void print_inst(FILE *out, Inst *inst) {
+  fprintf(out, "  %s", inst->op);
+  for (int i = 0; i < inst->nargs; i++)
+    fprintf(out, "%s%s", i ? ", " : " ", inst->arg[i]);
+  fprintf(out, "\n");
+}
+
+/**
+ * Make an instruction that moves RSP.
+ *
+ * @param bytes Bytes to move it up by, or down by if negative
+ * @param keep_flags Use lea, which leaves the flags alone, rather than add or
+ *                   sub
+ *
+ * @return Instruction
+ */
+static Inst adjust_rsp(int bytes, bool keep_flags) {
+  Inst inst = {.nargs = 2};
+  strcpy(inst.arg[0], "rsp");
+  if (keep_flags) {
+    strcpy(inst.op, "lea");
+    snprintf(inst.arg[1], sizeof(inst.arg[1]), "[rsp %c %d]",
+             bytes < 0 ? '-' : '+', abs(bytes));
+  } else {
+    strcpy(inst.op, bytes < 0 ? "sub" : "add");
+    snprintf(inst.arg[1], sizeof(inst.arg[1]), "%d", abs(bytes));
+  }
+  return inst;
+}
+
+/**
+ * Replace push and pop with moves to and from stack slots, so that they no
+ * longer serialize on RSP. RSP is lowered once at the start of the block and
+ * raised at its end to where the pushes and pops would have left it.
+ *
+ * If every value pushed in the block is also popped in it, each push gets a
+ * slot of its own so that independent subexpressions do not share slots.
+ * Otherwise values land exactly where push would have put them.
+ *
+ * @param block Instructions, with room for two more
+ * @param len Number of instructions, updated
+ * @param cut Was the block cut from its neighbours by the window, so that the
+ *            flags can be live on entry or exit
+ *
+ * @return False if the block uses RSP in any other way
+ */
+static bool lower_push_pop(Inst *block, int *len, bool cut) {
+  int depth = 0, max_depth = 0, min_depth = 0, pushes = 0, size;
+  for (int i = 0; i < *len; i++) {
+    Inst *inst = &block[i];
+    if (!strcmp(inst->op, "push")) {
+      if (strchr(inst->arg[0], '[')) return false;
+      pushes++;
+      depth++;
+    } else if (!strcmp(inst->op, "pop")) {
+      if (find_reg(inst->arg[0], strlen(inst->arg[0]), &size) < 0 || size != 0)
+        return false;
+      depth--;
+    } else if (strcmp(inst->op, "ret")) {
+      for (int j = 0; j < inst->nargs; j++)
+        if (strstr(inst->arg[j], "rsp")) return false;
+    }
+
+    if (depth > max_depth) max_depth = depth;
+    if (depth < min_depth) min_depth = depth;
+  }
+  if (pushes == 0 && depth == 0) return true;
+
+  // Slots are offsets from the lowered RSP
+  bool own_slots = depth == 0 && min_depth == 0;
+  int frame      = (own_slots ? pushes : max_depth) * 8;
+  int *slots     = mem_alloc(MEM_SCHED, (max_depth + 1) * sizeof(int));
+  Inst *out      = mem_alloc(MEM_SCHED, (*len + 2) * sizeof(Inst));
+  int n = 0, next_slot = 0;
+  depth = 0;
+
+  if (frame > 0) out[n++] = adjust_rsp(-frame, cut);
+  for (int i = 0; i < *len; i++) {
+    Inst *inst = &block[i];
+
+    if (!strcmp(inst->op, "push")) {
+      depth++;
+      int off = own_slots ? next_slot++ * 8 : frame - depth * 8;
+      if (own_slots) slots[depth] = off;
+
+      Inst mov = {.op = "mov", .nargs = 2};
+      snprintf(mov.arg[0], sizeof(mov.arg[0]), "qword ptr [rsp + %d]", off);
+      strcpy(mov.arg[1], inst->arg[0]);
+      out[n++] = mov;
+      continue;
+    }
+
+    if (!strcmp(inst->op, "pop")) {
+      int off = own_slots ? slots[depth] : frame - depth * 8;
+      depth--;
+
+      Inst mov = {.op = "mov", .nargs = 2};
+      strcpy(mov.arg[0], inst->arg[0]);
+      snprintf(mov.arg[1], sizeof(mov.arg[1]), "qword ptr [rsp + %d]", off);
+      out[n++] = mov;
+      continue;
+    }
+
+    // RSP goes back up before the terminator
+    if (!strcmp(inst->op, "ret") || inst->op[0] == 'j') break;
+    out[n++] = *inst;
+  }
+
+  if (frame - depth * 8 > 0) out[n++] = adjust_rsp(frame - depth * 8, cut);
+  Inst *last = &block[*len - 1];
+  if (!strcmp(last->op, "ret") || last->op[0] == 'j') out[n++] = *last;
+
+  memcpy(block, out, n * sizeof(Inst));
+  mem_free(MEM_SCHED, out, (*len + 2) * sizeof(Inst));
+  mem_free(MEM_SCHED, slots, (max_depth + 1) * sizeof(int));
+  *len = n;
+  return true;
+}
+
+/**
+ * Rewrite the one-operand "imul r" as "imul rax, r" where the high half that
+ * it leaves in RDX is never read, so that the multiplication is no longer
+ * pinned to RAX and RDX.
+ *
+ * @param block Analyzed instructions
+ * @param len Number of instructions
+ */
+static void use_two_operand_imul(Inst *block, int len) {
+  for (int i = 0; i < len; i++) {
+    Inst *inst = &block[i];
+    if (strcmp(inst->op, "imul") || inst->nargs != 1 || inst->loads) continue;
+
+    // RDX must be overwritten before it is read, or the function must return
+    bool dead = false;
+    for (int j = i + 1; j < len; j++) {
+      if (block[j].uses & 1u << REG_RDX) break;
+      if (block[j].defs & 1u << REG_RDX || !strcmp(block[j].op, "ret")) {
+        dead = true;
+        break;
+      }
+    }
+    if (!dead) continue;
+
+    strcpy(inst->arg[1], inst->arg[0]);
+    strcpy(inst->arg[0], "rax");
+    inst->nargs = 2;
+    analyze_inst(inst);
+  }
+}
+
+/**
+ * Substitute a register family in an operand, keeping operand sizes.
+ *
+ * @param arg Operand
+ * @param from Register family to replace
+ * @param to Replacement register family
+ */
+static void rename_operand(char *arg, int from, int to) {
+  char buf[sizeof(((Inst *)0)->arg[0]) * 2];
+  int n = 0;
+  for (char *p = arg; *p;) {
+    if (!isalpha(*p)) {
+      buf[n++] = *p++;
+      continue;
+    }
+
+    char *q = p;
+    while (isalnum(*p)) p++;
+    int size, r = find_reg(q, p - q, &size);
+    if (r == from)
+      n += sprintf(buf + n, "%s", reg_names[to][size]);
+    else
+      n += sprintf(buf + n, "%.*s", (int)(p - q), q);
+  }
+  buf[n] = '\0';
+  snprintf(arg, sizeof(((Inst *)0)->arg[0]), "%s", buf);
+}
+
+// Live range of a value in a register
+typedef struct {
+  int reg;     // Register family the value was generated in
+  int start;   // Instruction that defines it, or -1 if live on entry
+  int end;     // Last instruction that reads it
+  bool fixed;  // Must stay in reg
+  int assign;  // Register family it is renamed to
+} Range;
+
+/**
+ * Rename values to registers that the program never mentions, so that
+ * independent subexpressions stop reusing RAX and RDI and can be interleaved.
+ * Values read or written by implicit operands, or live on entry or exit, stay
+ * where they are.
+ *
+ * @param block Analyzed instructions
+ * @param len Number of instructions
+ * @param free_regs Register families available for renaming
+ */
+static void rename_regs(Inst *block, int len, uint32_t free_regs) {
+  int max_ranges = (len + 1) * NUM_REGS;
+  Range *ranges  = mem_alloc(MEM_SCHED, max_ranges * sizeof(Range));
+  int *range_of  = mem_alloc(MEM_SCHED, len * NUM_REGS * sizeof(int));
+  int cur[NUM_REGS];
+  int nranges = 0;
+
+  for (int r = 0; r < NUM_REGS; r++) {
+    ranges[nranges] = (Range){r, -1, -1, true, r};
+    cur[r]          = nranges++;
+  }
+
+  for (int i = 0; i < len; i++) {
+    Inst *inst = &block[i];
+    for (int r = 0; r < NUM_REGS; r++) {
+      bool use = inst->uses & 1u << r, def = inst->defs & 1u << r;
+      if (!use && !def) continue;
+
+      // A write that does not read the old value starts a new one
+      if (def && !use) {
+        ranges[nranges] = (Range){r, i, i, false, r};
+        cur[r]          = nranges++;
+      }
+
+      Range *range = &ranges[cur[r]];
+      if (use) range->end = i;
+      if (inst->fixed & 1u << r || r == REG_RSP) range->fixed = true;
+      range_of[i * NUM_REGS + r] = cur[r];
+    }
+  }
+  for (int r = 0; r < NUM_REGS; r++) ranges[cur[r]].fixed = true;
+
+  // Give each value, in order of definition, the register that has been idle
+  // the longest among those not holding an overlapping value. The original
+  // register always qualifies: only values from the same register can be in
+  // it, and those never overlap.
+  int busy_until[NUM_REGS];
+  for (int r = 0; r < NUM_REGS; r++) busy_until[r] = -1;
+
+  for (int k = NUM_REGS; k < nranges; k++) {
+    Range *range = &ranges[k];
+    if (!range->fixed) {
+      int best = range->reg;
+      for (int r = 0; r < NUM_REGS; r++) {
+        if (!(free_regs & 1u << r) || busy_until[r] >= busy_until[best])
+          continue;
+
+        bool overlaps = false;
+        for (int m = 0; m < k && !overlaps; m++)
+          overlaps = ranges[m].assign == r && ranges[m].end >= range->start;
+        if (!overlaps) best = r;
+      }
+      range->assign = best;
+    }
+
+    if (range->end > busy_until[range->assign])
+      busy_until[range->assign] = range->end;
+  }
+
+  for (int i = 0; i < len; i++) {
+    Inst *inst   = &block[i];
+    bool renamed = false;
+    for (int r = 0; r < NUM_REGS; r++) {
+      if (!((inst->uses | inst->defs) & 1u << r)) continue;
+      int to = ranges[range_of[i * NUM_REGS + r]].assign;
+      if (to == r) continue;
+
+      for (int a = 0; a < inst->nargs; a++) rename_operand(inst->arg[a], r, to);
+      renamed = true;
+    }
+    if (renamed) analyze_inst(inst);
+  }
+
+  mem_free(MEM_SCHED, ranges, max_ranges * sizeof(Range));
+  mem_free(MEM_SCHED, range_of, len * NUM_REGS * sizeof(int));
+}
+
+// Dependency of one instruction on an earlier one
+typedef struct Edge Edge;
+struct Edge {
+  Edge *next;   // Next edge from the same instruction
+  int to;       // Dependent instruction
+  int latency;  // Cycles the dependent has to wait
+};
+
+/**
+ * Get the latency of the dependency of an instruction on an earlier one.
+ *
+ * @param a Earlier instruction
+ * @param b Later instruction
+ * @param uarch Target microarchitecture
+ *
+ * @return Latency, or -1 if b does not depend on a
+ */
+static int dependency(Inst *a, Inst *b, Uarch *uarch) {
+  bool alias = a->slot < 0 || b->slot < 0 || a->slot == b->slot;
+
+  // True dependencies wait for the result
+  if (a->defs & b->uses || (a->stores && b->loads && alias))
+    return uarch->cost[a->cls].latency;
+
+  // Anti and output dependencies only keep the order
+  if (a->uses & b->defs || a->defs & b->defs) return 0;
+  if ((a->loads || a->stores) && b->stores && alias) return 0;
+  if (b->terminator) return 0;
+  return -1;
+}
+
+/**
+ * Order a block by list scheduling over its dependency DAG. Every cycle, up to
+ * the issue width of ready instructions issue, those with the longest
+ * latency-weighted path to the end of the block first, and each instruction
+ * class issues no faster than its throughput allows.
+ *
+ * @param block Analyzed instructions
+ * @param len Number of instructions
+ * @param uarch Target microarchitecture
+ * @param order Set to the instruction indexes in scheduled order
+ */
+static void list_schedule(Inst *block, int len, Uarch *uarch, int *order) {
+  int max_edges = len * (len - 1) / 2;
+  Edge *edges   = mem_alloc(MEM_SCHED, max_edges * sizeof(Edge) + 1);
+  Edge **succs  = mem_alloc(MEM_SCHED, len * sizeof(Edge *));
+  int *npreds   = mem_alloc(MEM_SCHED, len * sizeof(int));
+  int *prio     = mem_alloc(MEM_SCHED, len * sizeof(int));
+  int *ready    = mem_alloc(MEM_SCHED, len * sizeof(int));
+  bool *done    = mem_alloc(MEM_SCHED, len * sizeof(bool));
+  int nedges    = 0;
+
+  for (int j = 0; j < len; j++)
+    for (int i = 0; i < j; i++) {
+      int latency = dependency(&block[i], &block[j], uarch);
+      if (latency < 0) continue;
+      edges[nedges] = (Edge){succs[i], j, latency};
+      succs[i]      = &edges[nedges++];
+      npreds[j]++;
+    }
+
+  for (int i = len - 1; i >= 0; i--) {
+    prio[i] = uarch->cost[block[i].cls].latency;
+    for (Edge *e = succs[i]; e; e = e->next)
+      if (e->latency + prio[e->to] > prio[i])
+        prio[i] = e->latency + prio[e->to];
+  }
+
+  double unit_free[NUM_CLASSES] = {0};
+  int n = 0;
+  for (int cycle = 0; n < len; cycle++) {
+    for (int issued = 0; issued < uarch->width; issued++) {
+      int best = -1;
+      for (int i = 0; i < len; i++) {
+        if (done[i] || npreds[i] > 0 || ready[i] > cycle) continue;
+        if (unit_free[block[i].cls] >= cycle + 1) continue;
+        if (best < 0 || prio[i] > prio[best]) best = i;
+      }
+      if (best < 0) break;
+
+      InstClass cls  = block[best].cls;
+      done[best]     = true;
+      order[n++]     = best;
+      unit_free[cls] = (unit_free[cls] > cycle ? unit_free[cls] : cycle) +
+                       uarch->cost[cls].throughput;
+
+      for (Edge *e = succs[best]; e; e = e->next) {
+        npreds[e->to]--;
+        if (cycle + e->latency > ready[e->to])
+          ready[e->to] = cycle + e->latency;
+      }
+    }
+  }
+
+  mem_free(MEM_SCHED, edges, max_edges * sizeof(Edge) + 1);
+  mem_free(MEM_SCHED, succs, len * sizeof(Edge *));
+  mem_free(MEM_SCHED, npreds, len * sizeof(int));
+  mem_free(MEM_SCHED, prio, len * sizeof(int));
+  mem_free(MEM_SCHED, ready, len * sizeof(int));
+  mem_free(MEM_SCHED, done, len * sizeof(bool));
+}
+
+/**
+ * Schedule a basic block and write it out. A block with an instruction that
+ * this pass does not understand is written unchanged.
+ *
+ * @param out Output stream
+ * @param block Parsed instructions
+ * @param len Number of instructions
+ * @param uarch Target microarchitecture
+ * @param free_regs Register families available for renaming
+ * @param cut Was the block cut from its neighbours by the window
+ */
+static void schedule_block(FILE *out, Inst *block, int len, Uarch *uarch,
+                           uint32_t free_regs, bool cut) {
+  Inst *work = mem_alloc(MEM_SCHED, (len + 2) * sizeof(Inst));
+  memcpy(work, block, len * sizeof(Inst));
+  int n = len;
+
+  bool ok = lower_push_pop(work, &n, cut);
+  for (int i = 0; ok && i < n; i++) ok = analyze_inst(&work[i]);
+  if (!ok) {
+    for (int i = 0; i < len; i++) print_inst(out, &block[i]);
+    mem_free(MEM_SCHED, work, (len + 2) * sizeof(Inst));
+    return;
+  }
+
+  use_two_operand_imul(work, n);
+  rename_regs(work, n, free_regs);
+
+  int *order = mem_alloc(MEM_SCHED, n * sizeof(int));
+  list_schedule(work, n, uarch, order);
+  for (int i = 0; i < n; i++) print_inst(out, &work[order[i]]);
+  mem_free(MEM_SCHED, order, n * sizeof(int));
+  mem_free(MEM_SCHED, work, (len + 2) * sizeof(Inst));
+}
+
+/**
+ * Check if assembly mentions a register family anywhere.
+ *
+ * @param text Assembly
+ * @param reg Register family
+ *
+ * @return Is it mentioned
+ */
+static bool mentions_reg(char *text, int reg) {
+  for (int s = 0; s < 3; s++) {
+    char *name = reg_names[reg][s];
+    int len    = strlen(name);
+    for (char *p = strstr(text, name); p; p = strstr(p + len, name))
+      if ((p == text || !isalnum(p[-1])) && !isalnum(p[len])) return true;
+  }
+  return false;
+}
+
+/**
+ * Schedule generated assembly. Labels, directives and control transfers split
+ * it into basic blocks, and each block is scheduled on its own.
+ *
+ * @param text Assembly, ending with a newline
+ * @param len Assembly length, updated
+ * @param uarch Target microarchitecture
+ *
+ * @return Scheduled assembly
+ */
+char *schedule(char *text, size_t *len, Uarch *uarch) {
+  // Caller-saved registers that the program never mentions are free to use
+  int caller_saved[] = {REG_RCX, REG_RSI, REG_R8, REG_R9, REG_R10, REG_R11};
+  uint32_t free_regs = 0;
+  for (int i = 0; i < sizeof(caller_saved) / sizeof(*caller_saved); i++)
+    if (!mentions_reg(text, caller_saved[i]))
+      free_regs |= 1u << caller_saved[i];
+
+  char *buf;
+  size_t buf_len;
+  FILE *out   = open_memstream(&buf, &buf_len);
+  Inst *block = mem_alloc(MEM_SCHED, SCHED_WINDOW * sizeof(Inst));
+  int n       = 0;
+  bool cut    = false;  // Was the last block cut short by the window
+
+  for (char *line = text; *line;) {
+    char *end = strchr(line, '\n');
+    *end      = '\0';
+
+    Inst inst;
+    if (parse_inst(line, &inst)) {
+      block[n++] = inst;
+      if (n == SCHED_WINDOW || !strcmp(inst.op, "ret") || inst.op[0] == 'j') {
+        bool full = n == SCHED_WINDOW;
+        schedule_block(out, block, n, uarch, free_regs, cut || full);
+        n   = 0;
+        cut = full;
+      }
+    } else {
+      schedule_block(out, block, n, uarch, free_regs, cut);
+      n   = 0;
+      cut = false;
+      fprintf(out, "%s\n", line);
+    }
+
+    *end = '\n';
+    line = end + 1;
+  }
+  schedule_block(out, block, n, uarch, free_regs, cut);
+
+  fclose(out);
+  mem_free(MEM_SCHED, block, SCHED_WINDOW * sizeof(Inst));
+  *len = buf_len;
+  return buf;
+}
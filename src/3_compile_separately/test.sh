@@ -15,6 +15,416 @@ assert() {
     echo "$input => $expected expected, but got $actual"
     exit 1
   fi
+
+  # Scheduling must not change the result
+  for uarch in generic skylake zen3; do
+    ./c_compiler --sched=$uarch "$input" > tmp.s
+    cc -o tmp tmp.s
+    ./tmp > /dev/null 2>&1
+    actual="$?"
+    if [ "$actual" != "$expected" ]; then
+      echo "$input => $expected expected, but got $actual with --sched=$uarch"
+      exit 1
+    fi
+  done
+
+  # Pipelined compilation must not change the result
+  ./c_compiler --pipeline "$input" > tmp.s
+  cc -o tmp tmp.s
+  ./tmp > /dev/null 2>&1
+  actual="$?"
+  if [ "$actual" != "$expected" ]; then
+    echo "$input => $expected expected, but got $actual with --pipeline"
+    exit 1
+  fi
+
+  # Assembling and linking through pipes, without the C runtime, must not
+  # change the result
+  ./c_compiler -o tmp "$input"
+  ./tmp > /dev/null 2>&1
+  actual="$?"
+  if [ "$actual" != "$expected" ]; then
+    echo "$input => $expected expected, but got $actual with -o"
+    exit 1
+  fi
+
+  # Instruction selection and optimization levels must not change the result
+  for flags in --isel "--isel --sched=skylake" -O1 -O2 -fpass=fold,gen \
+    -fpass=range,isel --per-statement "-O1 --per-statement"; do
+    ./c_compiler $flags "$input" > tmp.s
+    cc -o tmp tmp.s
+    ./tmp > /dev/null 2>&1
+    actual="$?"
+    if [ "$actual" != "$expected" ]; then
+      echo "$input => $expected expected, but got $actual with $flags"
+      exit 1
+    fi
+  done
+
+  # Parallel code generation must not change the code
+  ./c_compiler "$input" > tmp.s
+  if ! ./c_compiler --jobs=3 "$input" | cmp -s - tmp.s; then
+    echo "$input => code differs with --jobs=3"
+    exit 1
+  fi
+
+  # Streaming through a window smaller than most tokens must not change the
+  # code
+  printf "%s" "$input" > tmp.txt
+  if ! ./c_compiler --stream=3 --file=tmp.txt | cmp -s - tmp.s; then
+    echo "$input => code differs with --stream=3"
+    exit 1
+  fi
+
+  # Generating code while parsing must not change it either
+  if ! ./c_compiler --one-pass "$input" | cmp -s - tmp.s; then
+    echo "$input => code differs with --one-pass"
+    exit 1
+  fi
+
+  # Compiling the binary AST, with or without a tree, must not change the code
+  ./c_compiler --emit-ast=bin "$input" > tmp.ast
+  if ! ./c_compiler --from-ast=tmp.ast | cmp -s - tmp.s; then
+    echo "$input => code differs with --from-ast"
+    exit 1
+  fi
+  ./c_compiler -O2 "$input" > tmp.s
+  if ! ./c_compiler -O2 --from-ast=tmp.ast | cmp -s - tmp.s; then
+    echo "$input => code differs with -O2 --from-ast"
+    exit 1
+  fi
+
+  # Interpreters must agree with the native code
+  for mode in --interp --interp=tree; do
+    ./c_compiler "$mode" "$input" > /dev/null 2>&1
+    actual="$?"
+    if [ "$actual" != "$expected" ]; then
+      echo "$input => $expected expected, but got $actual with $mode"
+      exit 1
+    fi
+  done
+}
+
+# Expect compilation to fail with a given number of diagnostics
+assert_error() {
+  expected="$1"
+  input="$2"
+  shift 2
+
+  ./c_compiler "$@" "$input" > tmp.s 2> tmp.err
+  status="$?"
+  actual=$(grep -c '\^ ' tmp.err)
+
+  if [ "$status" = 1 ] && [ "$actual" = "$expected" ]; then
+    echo "$input => $actual error(s)"
+  else
+    echo "$input => $expected error(s) expected, but got $actual (exit $status)"
+    cat tmp.err
+    exit 1
+  fi
+}
+
+# Expect a diagnostic at a given "line:col" of a multi-line source file
+assert_location() {
+  expected="$1"
+  source="$2"
+
+  printf "$source" > tmp.c
+  for flags in "" --stream=2; do
+    ./c_compiler $flags --file=tmp.c > tmp.s 2> tmp.err
+    actual=$(head -n 1 tmp.err | cut -d ' ' -f 1)
+
+    if [ "$actual" = "$expected" ]; then
+      echo "$source => $actual $flags"
+    else
+      echo "$source => $expected expected, but got $actual $flags"
+      cat tmp.err
+      exit 1
+    fi
+  done
+}
+
+# Expect the diagnostics of a source file to take a given number of bytes,
+# whether it is in memory or streamed
+assert_diag_size() {
+  expected="$1"
+  source="$2"
+
+  printf "%s" "$source" > tmp.c
+  for flags in "" --stream=4096; do
+    ./c_compiler $flags --file=tmp.c > tmp.s 2> tmp.err
+    actual=$(wc -c < tmp.err)
+
+    if [ "$actual" = "$expected" ]; then
+      echo "${source:0:40}... => $actual bytes of diagnostics $flags"
+    else
+      echo "${source:0:40}... => $expected bytes expected, but got $actual $flags"
+      exit 1
+    fi
+  done
+}
+
+# Expect a cached compilation to match an uncached one
+assert_cache() {
+  input="$1"
+
+  rm -rf tmp.cache
+  ./c_compiler "$input" > tmp.s
+  ./c_compiler --cache-dir=tmp.cache "$input" > tmp-miss.s
+  ./c_compiler --cache-dir=tmp.cache --cache-stats "$input" > tmp-hit.s \
+    2> tmp.err
+
+  if cmp -s tmp.s tmp-miss.s && cmp -s tmp.s tmp-hit.s &&
+    grep -q "1 hits, 1 misses" tmp.err; then
+    echo "$input => cached"
+  else
+    echo "$input => cache mismatch"
+    cat tmp.err
+    exit 1
+  fi
+}
+
+# Expect another build of the compiler not to find the entries of this one
+assert_cache_rebuilt() {
+  input="$1"
+
+  rm -rf tmp.cache
+  ./c_compiler --cache-dir=tmp.cache "$input" > /dev/null
+  ./c_compiler --cache-dir=tmp.cache "$input" > /dev/null
+  cp c_compiler tmp-c_compiler
+  ./tmp-c_compiler --cache-dir=tmp.cache --cache-stats "$input" > /dev/null \
+    2> tmp.err
+
+  if grep -q "1 hits, 2 misses" tmp.err; then
+    echo "$input => missed by another build"
+  else
+    echo "$input => found by another build"
+    cat tmp.err
+    exit 1
+  fi
+}
+
+# Expect an object file from -c to link with cc into a program returning the
+# expected value
+assert_object() {
+  expected="$1"
+  input="$2"
+  shift 2
+
+  ./c_compiler -c -o tmp.o "$@" "$input"
+  cc -o tmp tmp.o
+  ./tmp
+  actual="$?"
+
+  if [ "$actual" = "$expected" ]; then
+    echo "$input => $actual from an object"
+  else
+    echo "$input => $expected expected from an object, but got $actual"
+    exit 1
+  fi
+}
+
+# Expect a failed compilation with -o to leave no output file behind
+assert_no_output() {
+  input="$1"
+  shift
+
+  rm -f tmp.out
+  if ./c_compiler "$@" -o tmp.out "$input" 2> /dev/null || [ -e tmp.out ]; then
+    echo "$input => output left behind with -o $*"
+    exit 1
+  fi
+  echo "$input => no output"
+}
+
+# Expect a deeply nested input to compile within a second, which it does not
+# if the compiler goes over it once for every level of nesting
+assert_fast() {
+  input="$1"
+  shift
+
+  if ! timeout 1 ./c_compiler "$@" "$input" > /dev/null; then
+    echo "${input:0:40}... => too slow with $*"
+    exit 1
+  fi
+  echo "${input:0:40}... => fast with $*"
+}
+
+# Expect a program with local variables to return the expected value in every
+# mode that lays out a frame for them
+assert_local() {
+  expected="$1"
+  input="$2"
+
+  for flags in "" --sched=skylake -O1 -O2 "--isel --sched=zen3" \
+    -fpass=fold,gen -fpass=range,isel --frame-slots "-O2 --frame-slots"; do
+    ./c_compiler $flags "$input" > tmp.s
+    cc -o tmp tmp.s
+    ./tmp
+    actual="$?"
+    if [ "$actual" != "$expected" ]; then
+      echo "$input => $expected expected, but got $actual with $flags"
+      exit 1
+    fi
+  done
+
+  ./c_compiler -O2 -o tmp "$input"
+  ./tmp
+  actual="$?"
+  if [ "$actual" != "$expected" ]; then
+    echo "$input => $expected expected, but got $actual with -O2 -o"
+    exit 1
+  fi
+
+  ./c_compiler "$input" > tmp.s
+  if ! ./c_compiler --jobs=3 "$input" | cmp -s - tmp.s; then
+    echo "$input => code differs with --jobs=3"
+    exit 1
+  fi
+  echo "$input => $actual"
+}
+
+# Expect the generated code to access memory a given number of times: pushes,
+# pops and instructions with a memory operand other than lea
+assert_memops() {
+  expected="$1"
+  input="$2"
+  shift 2
+
+  ./c_compiler "$@" "$input" > tmp.s
+  actual=$(awk '$1 == "push" || $1 == "pop" || ($1 != "lea" && /\[/)' tmp.s |
+    wc -l)
+
+  if [ "$actual" = "$expected" ]; then
+    echo "$input => $actual memory operations $*"
+  else
+    echo "$input => $expected memory operations expected, but got $actual $*"
+    cat tmp.s
+    exit 1
+  fi
+}
+
+# Expect --mem-report to count a given number of objects in a category
+assert_mem() {
+  category="$1"
+  expected="$2"
+  input="$3"
+  shift 3
+
+  ./c_compiler --mem-report "$@" "$input" > tmp.s 2> tmp.err
+  actual=$(awk -v c="$category" '$1 == c { print $2; exit }' tmp.err)
+
+  if [ "$actual" = "$expected" ]; then
+    echo "$input => $actual $category objects"
+  else
+    echo "$input => $expected $category objects expected, but got $actual"
+    cat tmp.err
+    exit 1
+  fi
+}
+
+# Expect --cost-report to report a given value for a metric
+assert_cost() {
+  metric="$1"
+  expected="$2"
+  input="$3"
+  shift 3
+
+  ./c_compiler --cost-report "$@" "$input" > tmp.s 2> tmp.err
+  actual=$(grep "^$metric  " tmp.err | awk '{ print $NF }')
+
+  if [ "$actual" = "$expected" ]; then
+    echo "$input => $metric $actual"
+  else
+    echo "$input => $metric $expected expected, but got $actual"
+    cat tmp.err
+    exit 1
+  fi
+}
+
+# Expect --rewrite-stats to count a given number of sites for a rewrite
+assert_rewrite() {
+  rewrite="$1"
+  expected="$2"
+  input="$3"
+  shift 3
+
+  ./c_compiler --rewrite-stats "$@" "$input" > tmp.s 2> tmp.err
+  actual=$(awk -v r="$rewrite" '$1 == r { print $2 }' tmp.err)
+
+  if [ "$actual" = "$expected" ]; then
+    echo "$input => $rewrite $actual"
+  else
+    echo "$input => $rewrite $expected expected, but got $actual"
+    cat tmp.err
+    exit 1
+  fi
+}
+
+# Value of input column $1 at row $2, as filled in by the kernel driver
+column_value() {
+  echo $((($2 * 7 + $1 * 13) % 23 - 11))
+}
+
+# Expect a kernel to compute, for every row, what --interp computes for the
+# expression with the row's column values substituted
+assert_kernel() {
+  names="$1"
+  input="$2"
+  rows=11
+
+  cat > tmp-driver.c <<'EOF'
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+void f(const int64_t **cols, int64_t *out, size_t n);
+int main(int argc, char **argv) {
+  int ncols = atoi(argv[1]), rows = atoi(argv[2]);
+  const int64_t *cols[16];
+  for (int c = 0; c < ncols; c++) {
+    int64_t *col = malloc(rows * sizeof(int64_t));
+    for (int r = 0; r < rows; r++) col[r] = (r * 7 + c * 13) % 23 - 11;
+    cols[c] = col;
+  }
+  int64_t *out = malloc(rows * sizeof(int64_t));
+  f(cols, out, rows);
+  for (int r = 0; r < rows; r++) printf("%ld\n", (long)out[r]);
+  return 0;
+}
+EOF
+
+  for isa in avx2 scalar "avx2 -O1"; do
+    set -- $isa
+    ./c_compiler --kernel=f --kernel-isa=$1 ${2-} "$input" > tmp.s
+    ./c_compiler --emit-ast=bin "$input" > tmp.ast
+    if ! ./c_compiler --kernel=f --kernel-isa=$1 ${2-} --from-ast=tmp.ast |
+      cmp -s - tmp.s; then
+      echo "$input => kernel ($isa) differs with --from-ast"
+      exit 1
+    fi
+    cc -o tmp tmp.s tmp-driver.c
+    ./tmp $(echo $names | wc -w) $rows > tmp-actual.txt
+
+    : > tmp-expected.txt
+    for row in $(seq 0 $((rows - 1))); do
+      expr="$input"
+      index=0
+      for name in $names; do
+        value=$(column_value $index $row)
+        expr=$(echo "$expr" | sed "s/\b$name\b/($value)/g")
+        index=$((index + 1))
+      done
+      ./c_compiler --interp "$expr" >> tmp-expected.txt
+    done
+
+    if cmp -s tmp-expected.txt tmp-actual.txt; then
+      echo "$input => kernel ($isa)"
+    else
+      echo "$input => kernel ($isa) mismatch"
+      paste tmp-expected.txt tmp-actual.txt
+      exit 1
+    fi
+  done
 }
 
 assert 0 "0"
@@ -37,5 +447,127 @@ assert 1 "1 <= 1"
 assert 1 "1 > 0"
 assert 0 "1 > 1"
 assert 1 "1 >= 1"
+assert 64 "1000000 * 1000000 / 1000000"
+assert 253 "-7 / 2"
+assert 1 "2147483647 * 2147483647 * 4 == 4 - 2147483647 * 8 - 8"
+assert 136 "1 / (1 - 1)"
+assert 33 "(1 + 2) * (3 + 4) * (5 - 6) / (7 - 9) + (10 == 10) * (11 < 12) * 23"
+assert 44 "$(printf '1 + %.0s' $(seq 299))1"
+assert 136 "$(printf '1 + %.0s' $(seq 4999))1"
+assert 107 "(1+2*3)*4 + 7 - -(8/2) + (5*9+3) + ((1+2)+(3*4)+5)"
+assert 27 "1 - 2 * 3 + 9 * (7 - 5) + 4 / (1 + 1) + (3 <= 4) + 10 / 2 + (-6 < -5) - -5"
+assert 249 "((100 / 7) * (3 - 5) + (6 * 6) / 4) / ((2 + 2) - (9 / 3) + 1) + 2 / 1"
+assert 7 "1;2;3+4"
+assert 3 "1; 2; 3;"
+assert 5 "(1 + 2) * 3; 10 / 2"
+assert 136 "1 / 0; 2"
+assert 1 "1 + 2 == 3; 4 / (2 + 2) * 0 < 1; 2 < 3"
+assert 44 "$(printf '%d; %.0s' $(seq 600))44"
+assert 1 "1000000 * 1000000 < 1000000 * 1000000 + 1"
+assert 7 "(65536 * 65535 + 7) / 1"
+assert 136 "(1 / 0 < 1) == 0"
+assert 136 "(1 < 2) * 0 + (1 / 0 <= 1) * 0"
+assert 1 "(2 < 3) == (1 / (3 - 2) < 4)"
+assert 1 "1 > 2 < 3 >= 0 == (4 > 3 > 0)"
+assert 4 "(3 > 2) + (1 >= (2 > 1)) * 2 + (5 > 4 > 3) * 4 + (1 < 2 > 0 <= 1)"
+assert 1 "$(printf '(%.0s' $(seq 150))1$(printf ') > 0%.0s' $(seq 150))"
+assert 1 "$(printf '(%.0s' $(seq 2000))1$(printf ')%.0s' $(seq 2000)); 1 > 0"
+assert 1 "$(printf '(%.0s' $(seq 2000))1$(printf ') > 0%.0s' $(seq 2000))"
+
+assert_error 1 "1 +"
+assert_error 1 "(1 + 2"
+assert_error 1 "1 2"
+assert_error 1 "1 + $ 2"
+assert_error 1 "1 + ) + 2"
+assert_error 3 "(1 + ) * (2 3) + (4 5)"
+assert_error 3 "1 + # + (2 * ) + (3 + )"
+assert_error 2 "1 + # + (2 * ) + (3 + )" --max-errors=2
+assert_error 3 "(1 + ) * (2 3) + (4 5)" --pipeline
+assert_error 2 "1 + ; (2 * 3; 4"
+assert_error 2 "1 + ; (2 * 3; 4" --per-statement
+assert_error 1 "1; x+1; 2" --per-statement
+assert_error 3 "(1 + ) * (2 3) + (4 5)" --one-pass
+assert_error 3 "(1 > ) > (2 3) >= (4 > 5 6)" --one-pass
+assert_error 1 "x > 1" --one-pass
+assert_error 1 ";"
+assert_error 3 "$(printf '1 + %.0s' $(seq 4999))# + (2 * ) + (3 + )" --pipeline
+
+assert_location "1:3:" "1 $"
+assert_location "3:6:" "1 +\n(2 *\n 3 + ))\n"
+assert_location "2:1:" "(1 +\n)"
+assert_location "2:401:" "1 +\n$(printf '1 + %.0s' $(seq 100))# + 1"
+
+assert_diag_size 162 "$(printf '1+%.0s' $(seq 100000))*"
+
+assert_cache "(2 + (41 * 2)) / 2"
+assert_cache_rebuilt "(2 + (41 * 2)) / 2"
+
+assert_object 42 "6 * 7"
+assert_object 3 "1 > 2; 3" -O2
+assert_no_output "1 +"
+assert_no_output "1 +" -c
+assert_no_output "x * 2"
+assert_no_output "x + 1" --per-statement
+
+assert_fast "$(printf '(%.0s' $(seq 20000))1$(printf ')%.0s' $(seq 20000));1>0" \
+  --one-pass
+assert_fast "$(printf '(%.0s' $(seq 20000))1$(printf ')>0%.0s' $(seq 20000))" \
+  --one-pass
+
+assert_local 3 "a = 3; a"
+assert_local 7 "a = 3; b = 4; a + b"
+assert_local 8 "a = 3; a = a + 5; a"
+assert_local 6 "a = b = 3; a + b"
+assert_local 42 "foo = 6; bar = 7; foo * bar"
+assert_local 10 "x = 1; x = x + x; x = x + x; x = x + x; x + 2"
+assert_local 1 "a = 5; b = a > 3; b == 1"
+assert_local 42 "a=1;b=2;c=3;d=4;e=5;f=6;a+b+c+d+e+f+a+b+c+d+e+f"
+assert_local 10 "a = 2; a + (a = 8)"
+assert_local 4 "a = 2; (a = 1) + a + a + a"
+assert_local 2 "a = 10; a / (a = 5)"
+assert_local 0 "n = 5; n * 0"
+assert_error 1 "a = a + 1"
+assert_error 1 "a = ; b = 1; b"
+for mode in --kernel=f --interp --interp=tree --pipeline --per-statement \
+  --one-pass --emit-ast=bin; do
+  assert_error 1 "x = 1; x + 1" $mode
+done
+assert_no_output "x = 1; x" --pipeline
+
+assert_memops 4 "x = 1; x = x + x; x = x + x; x = x + x; x + 2" -O1
+assert_memops 13 "x = 1; x = x + x; x = x + x; x = x + x; x + 2" -O1 \
+  --frame-slots
+assert_memops 6 "a = 1; b = 2; a + b" -O1
+
+assert_mem token 12 "(2 + (41 * 2)) / 2"
+assert_mem node 7 "(2 + (41 * 2)) / 2"
+assert_mem token 1 "(2 + (41 * 2)) / 2" --one-pass
+assert_mem node 0 "(2 + (41 * 2)) / 2" --one-pass
+
+assert_cost instructions 8 "1+2"
+assert_cost "stack stores" 3 "1+2"
+assert_cost "stack stores" 0 "1+2" --isel
+assert_cost "critical path" 43 "84/2" --isel
+
+assert_kernel "x" "x"
+assert_kernel "x y" "x * 3 + y / 2 == x"
+assert_kernel "a b c" "(a - b) * (c + 100000) * b / 3 - -c"
+assert_kernel "a b" "(a == b) + (a != b) * 2 + (a < b) * 4 + (a <= b) * 8"
+assert_kernel "a b" "(a > b) + (a >= 1) * 2 + (-5 < b) * 4 + (b <= a - 3) * 8"
+assert_kernel "price qty" "price * qty / 7"
+assert_kernel "a b" "a * 123456789 * 987654 * b + a * 2147483647 * 2147483647 * 5"
+assert_kernel "a b" "a-(b-(a*(b-(a-(b/(3-(a-(b-(a*(b-(a-(b-(a!=(b-7))))))))))))))"
+assert_kernel "a b" "a * 2; b - a; (a < b) + b"
+assert_kernel "a b" "(a < b) * (b < a + 3) * 7 + (a <= b) / ((a == b) + 1)"
+
+assert_rewrite const 1 "1000000 * 1000000 < 1000000 * 1000000 + 1" -O1
+assert_rewrite test 1 "(1 / 0 < 1) != 0" -O1
+assert_rewrite dead 1 "1 + 2 * 3; 65536 * 65536" -fpass=range,isel
+assert_rewrite imul32 1 "65536 * 65535 + 7" -fpass=range,isel
+assert_rewrite div32 1 "(65536 * 65535 + 7) / 1" -fpass=range,isel
+assert_rewrite movzb 1 "(1 / 0 < 1) == 0" -O1
+assert_rewrite imul32 1 "(a < b) * 7 + a" --kernel=f -O1
+assert_rewrite div32 0 "(a < b) / (a - b)" --kernel=f -O1
+assert_error 1 "x + 1"
 
 echo OK
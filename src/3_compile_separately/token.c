@@ -1,8 +1,15 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include "c_compiler.h"
 
+char *user_input;
+Token *token;
+Token *(*next_token_chunk)(void);
+
 /**
  * Report an error and exit.
  *
@@ -17,26 +24,249 @@ void error(char *fmt, ...) {
   exit(1);
 }
 
+// Diagnostic
+typedef struct Diag Diag;
+struct Diag {
+  size_t pos;  // Byte offset of the error in the input
+  char *msg;   // Formatted error message
+};
+
+int max_errors  = 20;
+int error_count = 0;
+
+// Collected diagnostics
+static Diag *diags;
+
+// Part of the input that is in memory. An input read whole is all in it, with
+// buf pointing to user_input.
+typedef struct {
+  FILE *fp;     // File streamed from, or NULL if the input is in memory
+  char *path;   // Path of the file streamed from
+  char *buf;    // Bytes in memory, NUL-terminated
+  size_t cap;   // Size of buf
+  size_t len;   // Number of bytes in buf
+  size_t base;  // Byte offset in the input of buf[0]
+  char *cur;    // Where the next token is read from
+  bool eof;     // Does buf reach the end of the input
+} Window;
+
+static Window window;
+
+// Bytes shown on either side of an error in its line
+#define DIAG_CONTEXT 60
+
+// Byte offset at which each line of user_input starts, built on first use
+static size_t *line_starts;
+static size_t line_count;
+static size_t input_len;
+
 /**
- * Report an error and exit.
+ * Build the line start table. Newlines are located with memchr(), which libc
+ * implements with vector instructions.
+ */
+static void build_line_index(void) {
+  input_len = strlen(user_input);
+
+  size_t cap  = 1024;
+  line_starts = mem_alloc(MEM_DIAG, cap * sizeof(size_t));
+  line_count  = 1;
+
+  char *end = user_input + input_len;
+  for (char *p = user_input; (p = memchr(p, '\n', end - p)); p++) {
+    if (line_count == cap) {
+      line_starts = mem_realloc(MEM_DIAG, line_starts, cap * sizeof(size_t),
+                                cap * 2 * sizeof(size_t));
+      cap *= 2;
+    }
+    line_starts[line_count++] = p + 1 - user_input;
+  }
+}
+
+/**
+ * Find the line containing a byte offset.
+ *
+ * @param pos Byte offset in user_input
+ *
+ * @return Zero-based line number
+ */
+static size_t find_line(size_t pos) {
+  if (!line_starts) build_line_index();
+
+  size_t lo = 0, hi = line_count;
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (line_starts[mid] <= pos)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/**
+ * Print a diagnostic of a streamed input like print_diag(). The file is scanned
+ * again up to the error to count lines.
+ *
+ * @param pos Byte offset of the error
+ * @param msg Error message
+ */
+static void print_streamed_diag(size_t pos, char *msg) {
+  FILE *fp = fopen(window.path, "r");
+  if (!fp) error("cannot open %s: %s", window.path, strerror(errno));
+
+  char buf[65536];
+  size_t line = 0, start = 0;
+  for (size_t off = 0; off < pos;) {
+    size_t want = pos - off < sizeof(buf) ? pos - off : sizeof(buf);
+    size_t n    = fread(buf, 1, want, fp);
+    if (n == 0) break;
+    for (char *p = buf; (p = memchr(p, '\n', buf + n - p)); p++) {
+      line++;
+      start = off + (p - buf) + 1;
+    }
+    off += n;
+  }
+
+  // There is no newline between from and pos
+  size_t col  = pos - start;
+  size_t from = col > DIAG_CONTEXT ? pos - DIAG_CONTEXT : start;
+  fseeko(fp, from, SEEK_SET);
+  size_t n   = fread(buf, 1, pos - from + DIAG_CONTEXT, fp);
+  char *tail = buf + pos - from;
+  char *nl   = n > pos - from ? memchr(tail, '\n', buf + n - tail) : NULL;
+  if (nl) n = nl - buf;
+  fclose(fp);
+
+  int indent = fprintf(stderr, "%zu:%zu: ", line + 1, col + 1);
+  fwrite(buf, 1, n, stderr);
+  fputc('\n', stderr);
+
+  for (size_t i = 0; i < indent + pos - from; i++) fputc(' ', stderr);
+  fprintf(stderr, "^ %s\n", msg);
+}
+
+/**
+ * Print a diagnostic as "line:col: " followed by the offending line only, with
+ * a caret under the error location. Only DIAG_CONTEXT bytes on either side of
+ * the error are shown, so that an error in a huge line prints a short one.
+ *
+ * @param pos Byte offset of the error
+ * @param msg Error message
+ */
+static void print_diag(size_t pos, char *msg) {
+  if (window.fp) {
+    print_streamed_diag(pos, msg);
+    return;
+  }
+
+  size_t line  = find_line(pos);
+  size_t start = line_starts[line];
+  size_t end   = line + 1 < line_count ? line_starts[line + 1] - 1 : input_len;
+  size_t col   = pos - start;
+  size_t from  = col > DIAG_CONTEXT ? pos - DIAG_CONTEXT : start;
+  if (end - pos > DIAG_CONTEXT) end = pos + DIAG_CONTEXT;
+
+  int indent = fprintf(stderr, "%zu:%zu: ", line + 1, col + 1);
+  fwrite(user_input + from, 1, end - from, stderr);
+  fputc('\n', stderr);
+
+  for (size_t i = 0; i < indent + pos - from; i++) fputc(' ', stderr);
+  fprintf(stderr, "^ %s\n", msg);
+}
+
+/**
+ * Format a message into a newly allocated string.
+ *
+ * @param fmt Message format
+ * @param ap Message format arguments
+ *
+ * @return Formatted message
+ */
+static char *format(char *fmt, va_list ap) {
+  va_list aq;
+  va_copy(aq, ap);
+  int len = vsnprintf(NULL, 0, fmt, aq);
+  va_end(aq);
+
+  char *msg = mem_alloc(MEM_DIAG, len + 1);
+  vsnprintf(msg, len + 1, fmt, ap);
+  return msg;
+}
+
+/**
+ * Print all collected diagnostics.
+ */
+void print_diagnostics(void) {
+  for (int i = 0; i < error_count; i++) print_diag(diags[i].pos, diags[i].msg);
+}
+
+/**
+ * Collect an error and continue. Once max_errors diagnostics have been
+ * collected, print them all and exit.
  *
- * @param loc Error location
+ * @param pos Byte offset of the error in the input
  * @param fmt Error message format
  * @param ... Error message format arguments
  */
-void error_at(char *loc, char *fmt, ...) {
+void report_at(size_t pos, char *fmt, ...) {
   va_list ap;
   va_start(ap, fmt);
+  char *msg = format(fmt, ap);
+  va_end(ap);
 
-  int pos = loc - user_input;
-  fprintf(stderr, "%s\n", user_input);
-  fprintf(stderr, "%*s", pos, " ");
-  fprintf(stderr, "^ ");
-  vfprintf(stderr, fmt, ap);
-  fprintf(stderr, "\n");
+  if (!diags) diags = mem_alloc(MEM_DIAG, max_errors * sizeof(Diag));
+  diags[error_count].pos = pos;
+  diags[error_count].msg = msg;
+  error_count++;
+  PROBE(error, pos, error_count, false);
+
+  if (error_count >= max_errors) {
+    print_diagnostics();
+    fprintf(stderr, "too many errors, stopping\n");
+    exit(1);
+  }
+}
+
+/**
+ * Report an error and exit. Diagnostics collected so far are printed first.
+ *
+ * @param pos Byte offset of the error in the input
+ * @param fmt Error message format
+ * @param ... Error message format arguments
+ */
+void error_at(size_t pos, char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  char *msg = format(fmt, ap);
+  va_end(ap);
+
+  PROBE(error, pos, error_count + 1, true);
+  print_diagnostics();
+  print_diag(pos, msg);
   exit(1);
 }
 
+bool panicking;
+
+/**
+ * Move to the next token.
+ */
+static void advance(void) {
+  token = token->next ? token->next : next_token_chunk();
+}
+
+/**
+ * Check if the current token is a synchronization point, i.e. ")", ";" or the
+ * end of the program.
+ *
+ * @return Is the current token a synchronization point
+ */
+static bool at_sync_point(void) {
+  return token->kind == TK_EOF ||
+         (token->kind == TK_RESERVED &&
+          (token->punct == PUNCT_RPAREN || token->punct == PUNCT_SEMI));
+}
+
 /**
  * Check if the current token is op.
  *
@@ -44,38 +274,82 @@ void error_at(char *loc, char *fmt, ...) {
  *
  * @return Is the current token op
  */
-bool consume(char *op) {
-  if (token->kind != TK_RESERVED || strlen(op) != token->len ||
-      memcmp(token->str, op, token->len))
-    return false;
-  token = token->next;
+bool consume(Punct op) {
+  if (token->kind != TK_RESERVED || token->punct != op) return false;
+  advance();
   return true;
 }
 
 /**
- * Ensure that the current token is op.
+ * Consume the current token if it is an identifier.
+ *
+ * @return Identifier token, or NULL if the current token is not one
+ */
+Token *consume_ident(void) {
+  if (token->kind != TK_IDENT) return NULL;
+  Token *tok = token;
+  advance();
+  return tok;
+}
+
+/**
+ * Look at the token after the current one without moving to it.
+ *
+ * @return Next token
+ */
+Token *peek(void) {
+  if (!token->next && token->kind != TK_EOF) token->next = next_token_chunk();
+  return token->next ? token->next : token;
+}
+
+/**
+ * Ensure that the current token is op. On a mismatch, report an error and skip
+ * tokens up to the next synchronization point, consuming it if it is op.
  *
  * @param op Operator
  */
-void expect(char *op) {
-  if (token->kind != TK_RESERVED || strlen(op) != token->len ||
-      memcmp(token->str, op, token->len))
-    error_at(token->str, "expected \"%s\"", op);
-  token = token->next;
+void expect(Punct op) {
+  if (consume(op)) {
+    panicking = false;
+    return;
+  }
+
+  if (!panicking) report_at(token->pos, "expected \"%s\"", punct_str[op]);
+  panicking = true;
+
+  while (!at_sync_point()) advance();
+  if (consume(op)) panicking = false;
 }
 
 /**
- * Get a number and move to the next token.
+ * Get a number and move to the next token. On a mismatch, report an error and
+ * return 0 so that parsing can go on.
  *
  * @return Number
  */
 int expect_number() {
-  if (token->kind != TK_NUM) error_at(token->str, "expected a number");
-  int val = token->val;
-  token   = token->next;
+  if (token->kind != TK_NUM) {
+    if (!panicking) report_at(token->pos, "expected a number");
+    panicking = true;
+    return 0;
+  }
+
+  panicking = false;
+  int val   = token->val;
+  advance();
   return val;
 }
 
+/**
+ * Ensure that all tokens have been consumed. Leftover tokens are reported once
+ * and skipped.
+ */
+void expect_eof(void) {
+  if (at_eof()) return;
+  if (!panicking) report_at(token->pos, "unexpected token");
+  while (!at_eof()) advance();
+}
+
 /**
  * Check if the current token is EOF.
  *
@@ -85,81 +359,357 @@ bool at_eof() {
   return token->kind == TK_EOF;
 }
 
+char *punct_str[] = {
+    [PUNCT_EQ] = "==",    [PUNCT_NE] = "!=",  [PUNCT_LE] = "<=",
+    [PUNCT_GE] = ">=",    [PUNCT_LT] = "<",   [PUNCT_GT] = ">",
+    [PUNCT_ADD] = "+",    [PUNCT_SUB] = "-",  [PUNCT_MUL] = "*",
+    [PUNCT_DIV] = "/",    [PUNCT_LPAREN] = "(",
+    [PUNCT_RPAREN] = ")", [PUNCT_SEMI] = ";", [PUNCT_ASSIGN] = "=",
+};
+
 /**
- * Create a new token.
+ * Classify the punctuator at the beginning of the input string.
  *
- * @param kind Token kind
- * @param cur Current token
- * @param str Token string
+ * @param p Input string
+ * @param punct Set to the punctuator found
  *
- * @return New token
+ * @return Punctuator length, or 0 if the input does not start with one
  */
-Token *new_token(TokenKind kind, Token *cur, char *str, int len) {
-  Token *tok = calloc(1, sizeof(Token));
-  tok->kind  = kind;
-  tok->str   = str;
-  tok->len   = len;
-  cur->next  = tok;
-  return tok;
+static int read_punct(char *p, Punct *punct) {
+  switch (*p) {
+    case '=':
+      *punct = p[1] == '=' ? PUNCT_EQ : PUNCT_ASSIGN;
+      return p[1] == '=' ? 2 : 1;
+    case '!':
+      if (p[1] != '=') return 0;
+      *punct = PUNCT_NE;
+      return 2;
+    case '<':
+      *punct = p[1] == '=' ? PUNCT_LE : PUNCT_LT;
+      return p[1] == '=' ? 2 : 1;
+    case '>':
+      *punct = p[1] == '=' ? PUNCT_GE : PUNCT_GT;
+      return p[1] == '=' ? 2 : 1;
+    case '+':
+      *punct = PUNCT_ADD;
+      return 1;
+    case '-':
+      *punct = PUNCT_SUB;
+      return 1;
+    case '*':
+      *punct = PUNCT_MUL;
+      return 1;
+    case '/':
+      *punct = PUNCT_DIV;
+      return 1;
+    case '(':
+      *punct = PUNCT_LPAREN;
+      return 1;
+    case ')':
+      *punct = PUNCT_RPAREN;
+      return 1;
+    case ';':
+      *punct = PUNCT_SEMI;
+      return 1;
+  }
+  return 0;
 }
 
 /**
- * Check if the input string starts with a given string.
+ * Read the token at the beginning of the input string, after any whitespace.
  *
  * @param p Input string
- * @param q Start string
+ * @param tok Set to the token: TK_EOF at the end of the input, or TK_INVALID
+ *            for a run of invalid characters
  *
- * @return Does the input string start with the given string
+ * @return Input string after the token
  */
-bool starts_with(char *p, char *q) {
-  return memcmp(p, q, strlen(q)) == 0;
+static char *read_token(char *p, Token *tok) {
+  while (isspace(*p)) p++;
+  tok->str = p;
+
+  if (!*p) {
+    tok->kind = TK_EOF;
+    tok->len  = 0;
+    return p;
+  }
+
+  // Punctuator
+  int len = read_punct(p, &tok->punct);
+  if (len) {
+    tok->kind = TK_RESERVED;
+    tok->len  = len;
+    return p + len;
+  }
+
+  // Identifier
+  if (isalpha(*p) || *p == '_') {
+    char *q = p;
+    while (isalnum(*p) || *p == '_') p++;
+    tok->kind = TK_IDENT;
+    tok->len  = p - q;
+    return p;
+  }
+
+  if (isdigit(*p)) {
+    char *q   = p;
+    tok->kind = TK_NUM;
+    tok->val  = strtol(p, &p, 10);
+    tok->len  = p - q;
+    return p;
+  }
+
+  // The whole run of invalid characters
+  p++;
+  while (*p && !isspace(*p) && !isalnum(*p) && *p != '_' &&
+         !strchr("+-*/()<>=!;", *p))
+    p++;
+  tok->kind = TK_INVALID;
+  tok->len  = p - tok->str;
+  return p;
 }
 
+// Identifier names of a streamed input, which outlive the window they are in
+typedef struct Name Name;
+struct Name {
+  Name *next;  // Next name in the bucket
+  size_t len;  // Name length
+  char str[];  // Name, NUL-terminated
+};
+
+#define NAME_BUCKETS 256
+
+static Name *names[NAME_BUCKETS];
+
 /**
- * Tokenize input string.
+ * Get the copy of an identifier name kept outside the window.
  *
- * @param p Input string
+ * @param str Name
+ * @param len Name length
  *
- * @return Tokenized tokens
+ * @return The one copy of the name
  */
-Token *tokenize() {
-  char *p = user_input;
-  Token head;
-  head.next  = NULL;
-  Token *cur = &head;
+static char *intern(char *str, size_t len) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++) h = (h ^ (unsigned char)str[i]) * 16777619u;
 
-  while (*p) {
-    // Skip whitespace characters
-    if (isspace(*p)) {
-      p++;
-      continue;
+  Name **bucket = &names[h % NAME_BUCKETS];
+  for (Name *name = *bucket; name; name = name->next)
+    if (name->len == len && !memcmp(name->str, str, len)) return name->str;
+
+  Name *name = mem_alloc(MEM_TOKEN, sizeof(Name) + len + 1);
+  name->next = *bucket;
+  name->len  = len;
+  memcpy(name->str, str, len);
+  *bucket = name;
+  return name->str;
+}
+
+/**
+ * Stream the input from a file through a window of fixed size instead of
+ * reading it whole. Tokens that straddle the end of the window are read again
+ * once it has moved past them, so memory stays bounded by the window and the
+ * longest token, whatever the size of the file.
+ *
+ * @param path File path
+ * @param size Window size in bytes
+ */
+void stream_input(char *path, size_t size) {
+  FILE *fp = fopen(path, "r");
+  if (!fp) error("cannot open %s: %s", path, strerror(errno));
+
+  window     = (Window){.fp = fp, .path = path, .cap = size + 1};
+  window.buf = mem_alloc(MEM_INPUT, window.cap);
+  window.cur = window.buf;
+}
+
+/**
+ * Move the window to start at a given byte in it and fill the rest from the
+ * file. A window that would be full with that byte alone doubles in size.
+ *
+ * @param keep First byte to keep
+ */
+static void refill(char *keep) {
+  size_t kept = window.buf + window.len - keep;
+  memmove(window.buf, keep, kept);
+  window.base += keep - window.buf;
+
+  if (kept + 1 == window.cap) {
+    window.buf = mem_realloc(MEM_INPUT, window.buf, window.cap, window.cap * 2);
+    window.cap *= 2;
+  }
+
+  size_t want = window.cap - 1 - kept;
+  size_t n    = fread(window.buf + kept, 1, want, window.fp);
+  if (ferror(window.fp))
+    error("cannot read %s: %s", window.path, strerror(errno));
+
+  window.len             = kept + n;
+  window.buf[window.len] = '\0';
+  window.eof             = n < want;
+  window.cur             = window.buf;
+}
+
+/**
+ * Read the next token of the input.
+ *
+ * @param tok Set to the token: TK_EOF at the end of the input, or TK_INVALID
+ *            for a run of invalid characters
+ */
+void lex_token(Token *tok) {
+  if (!window.buf) {
+    window.buf = window.cur = user_input;
+    window.len              = strlen(user_input);
+    window.eof              = true;
+  }
+
+  while (true) {
+    char *p = read_token(window.cur, tok);
+
+    // A token that reaches the end of the window may go on past it
+    if (window.eof || p < window.buf + window.len) {
+      tok->pos   = window.base + (tok->str - window.buf);
+      window.cur = p;
+      if (window.fp)
+        tok->str = tok->kind == TK_IDENT ? intern(tok->str, tok->len) : NULL;
+      PROBE(token, tok->pos, tok->kind, tok->len);
+      return;
     }
+    refill(tok->str);
+  }
+}
 
-    // Multi-letter punctuator
-    if (starts_with(p, "==") || starts_with(p, "!=") || starts_with(p, "<=") ||
-        starts_with(p, ">=")) {
-      cur = new_token(TK_RESERVED, cur, p, 2);
-      p += 2;
-      continue;
+// Tokens are lexed this many at a time by tokenize_chunks(), alternately into
+// one of two buffers, since the parser may hold a token of the previous chunk
+#define STREAM_CHUNK 4096
+
+static Token *stream_chunks[2];
+static int next_chunk;
+
+/**
+ * Lex the next chunk of tokens, reporting invalid tokens.
+ *
+ * @return First token of the chunk
+ */
+static Token *lex_chunk(void) {
+  while (true) {
+    Token *chunk = stream_chunks[next_chunk];
+    next_chunk ^= 1;
+
+    Token head = {};
+    Token *cur = &head;
+    for (int i = 0; i < STREAM_CHUNK && cur->kind != TK_EOF; i++) {
+      Token *tok = &chunk[i];
+      lex_token(tok);
+      if (tok->kind == TK_INVALID) {
+        report_at(tok->pos, "invalid token");
+        continue;
+      }
+      cur->next = tok;
+      cur       = tok;
     }
+    cur->next = NULL;
+    if (head.next) return head.next;
+  }
+}
 
-    // Single-letter punctuator
-    if (strchr("+-*/()<>", *p)) {
-      cur = new_token(TK_RESERVED, cur, p++, 1);
+/**
+ * Tokenize the input a chunk at a time as the parser reaches the end of the
+ * previous one, reporting invalid tokens, so that tokens take constant memory.
+ *
+ * @return First chunk of tokens
+ */
+Token *tokenize_chunks(void) {
+  for (int i = 0; i < 2; i++)
+    stream_chunks[i] = mem_alloc(MEM_TOKEN, STREAM_CHUNK * sizeof(Token));
+  next_token_chunk = lex_chunk;
+  return lex_chunk();
+}
+
+// Tokens lexed one at a time by tokenize_on_demand(), alternately into one of
+// two slots, since the parser may hold the previous token
+static Token *demand_slots;
+static int next_slot;
+
+/**
+ * Lex the next valid token, reporting invalid ones.
+ *
+ * @return Token
+ */
+static Token *lex_on_demand(void) {
+  while (true) {
+    Token *tok = &demand_slots[next_slot];
+    lex_token(tok);
+    if (tok->kind == TK_INVALID) {
+      report_at(tok->pos, "invalid token");
       continue;
     }
+    next_slot ^= 1;
+    tok->next = NULL;
+    return tok;
+  }
+}
 
-    if (isdigit(*p)) {
-      cur      = new_token(TK_NUM, cur, p, 0);
-      char *q  = p;
-      cur->val = strtol(p, &p, 10);
-      cur->len = p - q;
+/**
+ * Tokenize the input one token at a time as the parser asks for them,
+ * reporting invalid tokens, so that tokens take the memory of two.
+ *
+ * @return First token
+ */
+Token *tokenize_on_demand(void) {
+  demand_slots     = mem_alloc(MEM_TOKEN, 2 * sizeof(Token));
+  next_token_chunk = lex_on_demand;
+  return lex_on_demand();
+}
+
+/**
+ * Get where the lexer reads the next token from.
+ *
+ * @return Byte offset in the input
+ */
+size_t lex_tell(void) {
+  return window.base + (window.cur - window.buf);
+}
+
+/**
+ * Move the lexer to read the next token from a given byte of an input that is
+ * in memory.
+ *
+ * @param pos Byte offset in the input
+ */
+void lex_seek(size_t pos) {
+  window.cur = window.buf + (pos - window.base);
+}
+
+/**
+ * Tokenize input string, reporting invalid tokens. A streamed input is
+ * tokenized with tokenize_chunks().
+ *
+ * @return Tokenized tokens
+ */
+Token *tokenize() {
+  if (window.fp) return tokenize_chunks();
+  PROBE(tokenize_start, user_input);
+
+  Token head;
+  head.next  = NULL;
+  Token *cur = &head;
+  Token *tok = NULL;
+
+  do {
+    // A token that turns out to be invalid is reused for the next one
+    if (!tok) tok = mem_alloc(MEM_TOKEN, sizeof(Token));
+    lex_token(tok);
+    if (tok->kind == TK_INVALID) {
+      report_at(tok->pos, "invalid token");
       continue;
     }
 
-    error_at(p, "invalid token");
-  }
+    cur->next = tok;
+    cur       = tok;
+    tok       = NULL;
+  } while (cur->kind != TK_EOF);
 
-  new_token(TK_EOF, cur, p, 0);
+  PROBE(tokenize_done, cur->pos);
   return head.next;
 }
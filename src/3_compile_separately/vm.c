@@ -0,0 +1,240 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "c_compiler.h"
+
+/**
+ * Append a byte to the bytecode.
+ *
+ * @param bc Bytecode
+ * @param byte Byte
+ */
+static void add_byte(Bytecode *bc, uint8_t byte) {
+  if (bc->len == bc->cap) {
+    size_t cap = bc->cap ? bc->cap * 2 : 64;
+    bc->code   = mem_realloc(MEM_BYTECODE, bc->code, bc->cap, cap);
+    bc->cap    = cap;
+  }
+  bc->code[bc->len++] = byte;
+}
+
+/**
+ * Lower a node to bytecode in post-order, as gen() does.
+ *
+ * @param bc Bytecode
+ * @param node Node
+ * @param depth Operand stack depth before the node is evaluated
+ */
+static void lower(Bytecode *bc, Node *node, int depth) {
+  if (depth + 1 > bc->max_depth) bc->max_depth = depth + 1;
+
+  if (node->kind == NODE_NUM) {
+    add_byte(bc, OP_PUSH);
+    uint32_t val = node->val;
+    for (int i = 0; i < 4; i++) add_byte(bc, val >> (i * 8));
+    return;
+  }
+
+  lower(bc, node->lhs, depth);
+  lower(bc, node->rhs, depth + 1);
+
+  switch (node->kind) {
+    case NODE_ADD:
+      add_byte(bc, OP_ADD);
+      break;
+    case NODE_SUB:
+      add_byte(bc, OP_SUB);
+      break;
+    case NODE_MUL:
+      add_byte(bc, OP_MUL);
+      break;
+    case NODE_DIV:
+      add_byte(bc, OP_DIV);
+      break;
+    case NODE_EQ:
+      add_byte(bc, OP_EQ);
+      break;
+    case NODE_NE:
+      add_byte(bc, OP_NE);
+      break;
+    case NODE_LT:
+      add_byte(bc, OP_LT);
+      break;
+    case NODE_LE:
+      add_byte(bc, OP_LE);
+      break;
+    case NODE_SEQ:
+      add_byte(bc, OP_SEQ);
+      break;
+  }
+}
+
+/**
+ * Compile a node tree to bytecode.
+ *
+ * @param node Parsed node
+ *
+ * @return Bytecode
+ */
+Bytecode *compile_bytecode(Node *node) {
+  Bytecode *bc = mem_alloc(MEM_BYTECODE, sizeof(Bytecode));
+  lower(bc, node, 0);
+  add_byte(bc, OP_RET);
+  return bc;
+}
+
+/**
+ * Check if a division traps on x86-64, i.e. raises #DE in idiv.
+ *
+ * @param lhs Dividend
+ * @param rhs Divisor
+ *
+ * @return Does the division trap
+ */
+static bool div_traps(int64_t lhs, int64_t rhs) {
+  return rhs == 0 || (lhs == INT64_MIN && rhs == -1);
+}
+
+/**
+ * Run bytecode on a stack machine with threaded dispatch. Arithmetic wraps
+ * around at 64 bits and division truncates toward zero, like the code from
+ * gen().
+ *
+ * @param bc Bytecode
+ * @param result Set to the value of the expression
+ *
+ * @return False if a division would have trapped
+ */
+bool run_bytecode(Bytecode *bc, int64_t *result) {
+  static void *dispatch[] = {
+      [OP_PUSH] = &&op_push, [OP_ADD] = &&op_add, [OP_SUB] = &&op_sub,
+      [OP_MUL] = &&op_mul,   [OP_DIV] = &&op_div, [OP_EQ] = &&op_eq,
+      [OP_NE] = &&op_ne,     [OP_LT] = &&op_lt,   [OP_LE] = &&op_le,
+      [OP_SEQ] = &&op_seq,   [OP_RET] = &&op_ret,
+  };
+
+  // Small expressions run on the C stack without allocating
+  int64_t buf[256];
+  int64_t *stack = bc->max_depth <= 256 ? buf : malloc(bc->max_depth * 8);
+  int64_t *sp    = stack;  // Next free slot
+  uint8_t *pc    = bc->code;
+  bool ok        = true;
+
+#define NEXT goto *dispatch[*pc++]
+#define BINARY(expr)       \
+  do {                     \
+    int64_t rhs = *--sp;   \
+    int64_t lhs = sp[-1];  \
+    sp[-1]      = (expr);  \
+    NEXT;                  \
+  } while (0)
+
+  NEXT;
+
+op_push:
+  *sp++ = (int32_t)(pc[0] | pc[1] << 8 | pc[2] << 16 | (uint32_t)pc[3] << 24);
+  pc += 4;
+  NEXT;
+op_add:
+  BINARY((uint64_t)lhs + (uint64_t)rhs);
+op_sub:
+  BINARY((uint64_t)lhs - (uint64_t)rhs);
+op_mul:
+  BINARY((uint64_t)lhs * (uint64_t)rhs);
+op_div:
+  if (div_traps(sp[-2], sp[-1])) {
+    ok = false;
+    goto op_ret;
+  }
+  BINARY(lhs / rhs);
+op_eq:
+  BINARY(lhs == rhs);
+op_ne:
+  BINARY(lhs != rhs);
+op_lt:
+  BINARY(lhs < rhs);
+op_le:
+  BINARY(lhs <= rhs);
+op_seq:
+  sp--;
+  sp[-1] = *sp;
+  NEXT;
+op_ret:
+  if (ok) *result = sp[-1];
+  if (stack != buf) free(stack);
+  return ok;
+
+#undef BINARY
+#undef NEXT
+}
+
+/**
+ * Evaluate a node tree by walking it recursively. This is the reference for
+ * the bytecode interpreter.
+ *
+ * @param node Parsed node
+ * @param result Set to the value of the expression
+ *
+ * @return False if a division would have trapped
+ */
+bool eval_tree(Node *node, int64_t *result) {
+  if (node->kind == NODE_NUM) {
+    *result = node->val;
+    return true;
+  }
+
+  int64_t lhs, rhs;
+  if (!eval_tree(node->lhs, &lhs) || !eval_tree(node->rhs, &rhs)) return false;
+
+  switch (node->kind) {
+    case NODE_ADD:
+      *result = (uint64_t)lhs + (uint64_t)rhs;
+      break;
+    case NODE_SUB:
+      *result = (uint64_t)lhs - (uint64_t)rhs;
+      break;
+    case NODE_MUL:
+      *result = (uint64_t)lhs * (uint64_t)rhs;
+      break;
+    case NODE_DIV:
+      if (div_traps(lhs, rhs)) return false;
+      *result = lhs / rhs;
+      break;
+    case NODE_EQ:
+      *result = lhs == rhs;
+      break;
+    case NODE_NE:
+      *result = lhs != rhs;
+      break;
+    case NODE_LT:
+      *result = lhs < rhs;
+      break;
+    case NODE_LE:
+      *result = lhs <= rhs;
+      break;
+    case NODE_SEQ:
+      *result = rhs;
+      break;
+  }
+  return true;
+}
+
+/**
+ * Report a value the way a program generated by gen() would: print it and
+ * exit with its low 8 bits as status, or die of SIGFPE if a division trapped.
+ *
+ * @param ok Was the value computed without trapping
+ * @param val Value
+ *
+ * @return Exit status
+ */
+int exit_with_value(bool ok, int64_t val) {
+  if (!ok) {
+    fflush(stdout);
+    signal(SIGFPE, SIG_DFL);
+    raise(SIGFPE);
+  }
+  printf("%ld\n", (long)val);
+  return val & 0xff;
+}